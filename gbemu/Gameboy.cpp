@@ -1,395 +1,308 @@
 #include "Gameboy.h"
+#include "pixels.h"
+
+static const ubyte shades[4][3] = { { WHITE }, { LIGHT_GREY }, { DARK_GREY }, { BLACK } };
 
 Gameboy::Gameboy() :
-cpu()
+cpu(),
+ppu(cpu)
 {
 	if (SDL_Init(SDL_INIT_EVERYTHING) < 0)
 	{
 		std::cout << "SDL Error: " << SDL_GetError() << std::endl;
 		exit(-2);
 	}
-	window = SDL_CreateWindow("gbemu", SDL_WINDOWPOS_UNDEFINED, SDL_WINDOWPOS_UNDEFINED, WINDOW_WIDTH, WINDOW_HEIGHT, NULL);
+	window = SDL_CreateWindow("gbemu", SDL_WINDOWPOS_UNDEFINED, SDL_WINDOWPOS_UNDEFINED, WINDOW_WIDTH, WINDOW_HEIGHT, SDL_WINDOW_RESIZABLE);
 	if (window == nullptr)
 	{
 		std::cout << "SDL_Window could not be created. Error: " << SDL_GetError() << std::endl;
 		return;
 	}
-	windowSurface = SDL_GetWindowSurface(window);
-	if (windowSurface == nullptr || windowSurface == NULL)
+	// no vsync, waitForFrame paces the frames to the Gameboy's refresh rate instead of the monitor's
+	renderer = SDL_CreateRenderer(window, -1, SDL_RENDERER_ACCELERATED);
+	if (renderer == nullptr)
 	{
-		std::cout << "SDL_Surface <windowSurface> could not be created. Error: " << SDL_GetError() << std::endl;
-		return;
+		// no GPU, SDL still scales in software
+		std::cout << "Accelerated SDL_Renderer could not be created, falling back to software. Error: " << SDL_GetError() << std::endl;
+		renderer = SDL_CreateRenderer(window, -1, SDL_RENDERER_SOFTWARE);
+		if (renderer == nullptr)
+		{
+			std::cout << "SDL_Renderer could not be created. Error: " << SDL_GetError() << std::endl;
+			return;
+		}
 	}
-	SDL_PixelFormat* fmt = windowSurface->format;
-	backgroundSurface = SDL_CreateRGBSurface(NULL, SCR_BUFFER_WIDTH, SCR_BUFFER_HEIGHT, fmt->BitsPerPixel, fmt->Rmask, fmt->Gmask, fmt->Bmask, fmt->Amask);
-	if (backgroundSurface == nullptr || backgroundSurface == NULL)
+	// the renderer scales the frame up to the window, by whole pixels so they all stay the same size
+	SDL_SetHint(SDL_HINT_RENDER_SCALE_QUALITY, "nearest");
+	SDL_RenderSetLogicalSize(renderer, LCD_WIDTH, LCD_HEIGHT);
+	SDL_RenderSetIntegerScale(renderer, SDL_TRUE);
+	frameTexture = SDL_CreateTexture(renderer, SDL_PIXELFORMAT_ARGB8888, SDL_TEXTUREACCESS_STREAMING, LCD_WIDTH, LCD_HEIGHT);
+	if (frameTexture == nullptr)
 	{
-		std::cout << "SDL_Surface <backgroundSurface> could not be created. Error: " << SDL_GetError() << std::endl;
+		std::cout << "SDL_Texture <frameTexture> could not be created. Error: " << SDL_GetError() << std::endl;
 		return;
 	}
-	fullScreenSurface = SDL_CreateRGBSurface(NULL, WINDOW_WIDTH, WINDOW_HEIGHT, fmt->BitsPerPixel, fmt->Rmask, fmt->Gmask, fmt->Bmask, fmt->Amask);
-	if (fullScreenSurface == nullptr || fullScreenSurface == NULL)
+	// the texture's pixel values of the 4 shades
+	SDL_PixelFormat* format = SDL_AllocFormat(SDL_PIXELFORMAT_ARGB8888);
+	for (int i = 0; i < 4; i++)
 	{
-		std::cout << "SDL_Surface <fullScreenSurface> could not be created. Error: " << SDL_GetError() << std::endl;
-		return;
+		shadeColors[i] = SDL_MapRGB(format, shades[i][0], shades[i][1], shades[i][2]);
 	}
-
-	// setup the surface copy rect to some constant values
-	srcSurfaceRect.w = SCR_BUFFER_WIDTH;
-	srcSurfaceRect.h = SCR_BUFFER_HEIGHT;
-	srcSurfaceRect.x = 0; 
-	srcSurfaceRect.y = 0;
-	// set up the pixel rect
-	pixel.h = 1;
-	pixel.w = 1;
-	// set up the scanline rect
-	scanLineRect.h = 1; // 1 pixel 
-	scanLineRect.w = WINDOW_WIDTH;
-	scanLineRect.x = 0;
+	SDL_FreeFormat(format);
 }
 
 Gameboy::~Gameboy()
 {
+#ifdef DEBUG
+	if (bgWindow != nullptr)
+	{
+		toggleBGView();
+	}
+#endif
+	SDL_DestroyTexture(frameTexture);
+	SDL_DestroyRenderer(renderer);
 	SDL_DestroyWindow(window);
 	SDL_Quit();
 }
 
 bool Gameboy::init(const std::string& romName)
 {
-	clear(windowSurface);
-	clear(backgroundSurface);
-	clear(fullScreenSurface);
+	clear(renderer);
 	return cpu.loadROM(romName);
 }
 
 void Gameboy::run()
 {
-	// CPU timings come from: http://hitmen.c02.at/files/releases/gbc/gbc_cpu_timing.txt
-	const int hblankLen = 456; // length in clock cycles of a single hblank
-	const int vBlankLen = hblankLen * 10; // length in clock cycles of a vblank (vblank is 10 h-lines (hblanks))
+	scanline = 0;
+	ppu.startFrame();
+	cpu.startLCD();
+	setLCDMode(lcdOAMScan);
+	lcdEventTime = cpu.getClockCycles() + oamScanLen;
+	cpu.events().schedule(evLCD, lcdEventTime);
 	while (running)
 	{
-		renderFull();
-		while (scanline != WINDOW_HEIGHT) // while still drawing the scanlines
+		switch (cpu.run()) // until the next event the CPU doesn't handle itself
 		{
-			drawScanline(); // draw the current scanline (hblank of course comes after this)
-			while (cpu.getClockCycles() < hblankLen) // emulate hblank
-			{
-				handleEvents();
-				cpu.emulateCycle(); // emulate the cycles through the hblank
-			}
-			cpu.resetClock(); // reset number of clock cycles
+			case evLCD: lcdEvent(); break;
 		}
-		// full rendering of screen has completed (all scanlines drawn)
-		// |-> emulate vblank
-		cpu.wByte(IF, 0x1); // set vblank interrupt
-		while (cpu.getClockCycles() < vBlankLen) // emulate vblank
+		if (cpu.isStopped())
 		{
-			scanline++; // keep incrementing the LY because many games check that for in the range of the vblank
-			cpu.wByte(LY, scanline);
-			handleEvents();
-			cpu.emulateCycle();
+			stop();
 		}
 	}
 }
 
-void Gameboy::drawScanline()
+void Gameboy::lcdEvent()
 {
-	// blitsurface modifies the scanLineRect width and height so they need to be reset here
-	scanLineRect.h = 1; // 1 pixel 
-	scanLineRect.w = WINDOW_WIDTH;
-	scanLineRect.y = scanline; 
-	// copy the 1x160 px slice at coords(0, line)
-	SDL_BlitSurface(fullScreenSurface, &scanLineRect, windowSurface, &scanLineRect);
-
-	cpu.wByte(LY, scanline);
-	if (cpu.rByte(LY) == cpu.rByte(LYC))
-	{
-		cpu.wByte(STAT, cpu.rByte(STAT) | b2);
-	}
-	else
-	{
-		cpu.wByte(STAT, cpu.rByte(STAT) & ~b2);
-	}
-	scanline++;
-	if (scanline == WINDOW_HEIGHT)
+	// CPU timings come from: http://hitmen.c02.at/files/releases/gbc/gbc_cpu_timing.txt
+	// each mode lasts a fixed number of cycles from when the last one was due, so running past it a few cycles doesn't add up
+	int length = 0;
+	switch (lcdMode)
 	{
-		// display
-		SDL_UpdateWindowSurface(window);
+		case lcdOAMScan:
+			// draw the line with the registers as they are now
+			ppu.renderLine(scanline);
+			setLCDMode(lcdTransfer);
+			length = transferLen;
+			break;
+		case lcdTransfer:
+			setLCDMode(lcdHBlank);
+			length = hblankLen;
+			break;
+		case lcdHBlank:
+			scanline++;
+			if (scanline == LCD_HEIGHT)
+			{
+				// full rendering of screen has completed (all scanlines drawn)
+				setLCDMode(lcdVBlank);
+				cpu.requestInterrupt(b0); // set vblank interrupt
+				waitForFrame();
+				presentFrame();
+				cpu.flushSaveRAM(); // the frame is done, start saving whatever the game wrote to battery RAM
+				handleEvents();
+				idle();
+				length = LINE_CYCLES;
+			}
+			else
+			{
+				setLCDMode(lcdOAMScan);
+				length = oamScanLen;
+			}
+			break;
+		case lcdVBlank:
+			if (scanline == NUM_LINES - 1)
+			{
+				scanline = 0;
+				ppu.startFrame();
+				setLCDMode(lcdOAMScan);
+				length = oamScanLen;
+			}
+			else
+			{
+				scanline++;
+				length = LINE_CYCLES;
+			}
+			break;
 	}
+	lcdEventTime += length;
+	cpu.events().schedule(evLCD, lcdEventTime);
 }
 
-void Gameboy::drawPixel(SDL_Surface* dest, const char r, const char g, const char b, const unsigned x, const unsigned y)
+void Gameboy::setLCDMode(int mode)
 {
-	pixel.x = x;
-	pixel.y = y;
-	// draw the pixel to the screenBuffer
-	SDL_FillRect(dest, &pixel, SDL_MapRGB(dest->format, r, g, b));
+	lcdMode = mode;
+	cpu.setLCDMode(mode);
 }
 
-void clear(SDL_Surface* surf)
+void Gameboy::presentFrame()
 {
-	// clear the surface to white
-	SDL_FillRect(surf, NULL, SDL_MapRGB(surf->format, WHITE));
-}
-
-void Gameboy::drawBGSlice(const byte b1, const byte b2, unsigned& x, unsigned& y)
-{
-	// the bits of the string are compared to create the color of each pixel
-	// 1. A bit that is 0 in both bytes will be a WHITE pixel
-	// 2. A bit that is 1 in the first byte and 0 in the second will be a GREY pixel
-	// 3. A bit that is 0 in the first byte and 1 in the second will be a DARK GREY pixel
-	// 4. A bit that is 1 in both bytes will be a BLACK pixel
-	// https://slashbinbash.wordpress.com/2013/02/07/gameboy-tile-mapping-between-image-and-memory/
-	for (int i = 0x80; i >= 1; i >>= 1)
+	// one pass over the whole frame straight into the texture, then a single upload
+	void* pixels;
+	int pitch;
+	if (SDL_LockTexture(frameTexture, nullptr, &pixels, &pitch) == 0)
 	{
-		int currBit0 = b1 & i; // get the value of the current bit
-		int currBit1 = b2 & i;
-		if (currBit0 && currBit1) // bit1 (on) and bit2 (on)
-		{
-			drawPixel(backgroundSurface, BLACK, x, y); // draw the pixel to the screenBuffer 
-		}
-		else if (!currBit0 && !currBit1) // bit1 (off) and bit2 (off)
-		{
-			drawPixel(backgroundSurface, WHITE, x, y); // draw the pixel to the screenBuffer 
-		}
-		else if (currBit0 && !currBit1) // bit1 (on) and bit2 (off)
+		const ubyte* frame = ppu.frameBuffer();
+		for (int y = 0; y < LCD_HEIGHT; y++)
 		{
-			drawPixel(backgroundSurface, LIGHT_GREY, x, y); // draw the pixel to the screenBuffer 
+			expandPixels(&frame[y * LCD_WIDTH], LCD_WIDTH, shadeColors, reinterpret_cast<uint32_t*>(static_cast<ubyte*>(pixels) + y * pitch));
 		}
-		else // bit1 (off) bit2 (on)
-		{
-			drawPixel(backgroundSurface, DARK_GREY, x, y); // draw the pixel to the screenBuffer 
-		}
-		x++;
+		SDL_UnlockTexture(frameTexture);
 	}
-	x -= 8;
-	y++;
-}
-
-void Gameboy::drawSpriteSlice(const byte b1, const byte b2, unsigned& x, unsigned& y)
-{
-	// 1. A bit that is 0 in both bytes will be a WHITE pixel
-	// 2. A bit that is 1 in the first byte and 0 in the second will be a GREY pixel
-	// 3. A bit that is 0 in the first byte and 1 in the second will be a DARK GREY pixel
-	// 4. A bit that is 1 in both bytes will be a BLACK pixel
-	// https://slashbinbash.wordpress.com/2013/02/07/gameboy-tile-mapping-between-image-and-memory/
-	for (int i = 0x80; i >= 1; i >>= 1)
+#ifdef DEBUG
+	if (bgWindow != nullptr)
 	{
-		int currBit0 = b1 & i; // get the value of the current bit
-		int currBit1 = b2 & i;
-		if (currBit0 && currBit1) // bit1 (on) and bit2 (on)
-		{
-			drawPixel(fullScreenSurface, BLACK, x, y); // draw the pixel to the screenBuffer 
-		}
-		else if (!currBit0 && !currBit1) // bit1 (off) and bit2 (off)
-		{
-			// b0 and b1 == 0 is clear for sprites
-		}
-		else if (currBit0 && !currBit1) // bit1 (on) and bit2 (off)
-		{
-			drawPixel(fullScreenSurface, LIGHT_GREY, x, y); // draw the pixel to the screenBuffer 
-		}
-		else // bit1 (off) bit2 (on)
-		{
-			drawPixel(fullScreenSurface, DARK_GREY, x, y); // draw the pixel to the screenBuffer 
-		}
-		x++;
+		drawBGView();
 	}
-	x -= 8;
-	y++;
+#endif
+	SDL_RenderClear(renderer);
+	SDL_RenderCopy(renderer, frameTexture, nullptr, nullptr);
+	SDL_RenderPresent(renderer);
 }
 
-void Gameboy::drawBG(const std::vector<byte>& mem)
+void Gameboy::waitForFrame()
 {
-	unsigned x = 0;
-	unsigned y = 0;
-	const int lcdc = cpu.rByte(LCDC);
-	if (lcdc & 0x40 != 0x0) // 0 = bg0, 1 = bg1
+	const uint64_t frequency = SDL_GetPerformanceFrequency();
+	const uint64_t frameTicks = frequency * frameCycles / clockSpeed;
+	uint64_t now = SDL_GetPerformanceCounter();
+	frameDue += frameTicks;
+	if (frameDue + frameTicks < now)
 	{
-		// bg0, draw all of the 8x8 tiles
-		for (int i = BG_MAP_0; i < BG_MAP_0_END; i++)
-		{
-			// draw the 8x8 tile
-			// first get the location in memory of the tile
-			addr16 chrLocStart;
-			if (lcdc & 0x10 != 0x0) // unsigned characters
-			{
-				chrLocStart = static_cast<ubyte>(mem[i]) * 0x10 + CHR_MAP_UNSIGNED; // get the location of the first tile slice in memory
-			}
-			else // signed characters
-			{
-				chrLocStart = mem[i] * 0x10 + CHR_MAP_SIGNED; // no cast because they are signed
-			}
-			// draw the slice pixel by pixel
-			for (int j = chrLocStart; j < chrLocStart + 0x10; j += 2) // note the += 2, 2 bytes per slice
-			{
-				drawBGSlice(mem[j], mem[j + 1], x, y); // draw the pixel of the slice
-			}
-			x += 8;
-			y -= 8;
-			if (x == SCR_BUFFER_WIDTH) // "hblank" (kind of) - at the end of the horiziontal screen, 
-			{						   // move the x back to 0 and move y down 8 
-				y += 8;
-				x = 0;
-			}
-		}
+		// more than a frame behind (after blocking, or the host can't keep up), carry on from now instead of rushing to catch up
+		frameDue = now;
+		return;
 	}
-	else // bg1 
+	// no spinning, sleeping a little early or late only moves this frame, frameDue keeps counting from the exact times so the rate doesn't drift
+	if (now < frameDue)
 	{
-		for (int i = BG_MAP_1; i < BG_MAP_1_END; i++)
-		{
-			// draw the 8x8 tile
-			addr16 chrLocStart;
-			if (lcdc & 0x10 != 0x0) // unsigned characters
-			{
-				chrLocStart = static_cast<ubyte>(mem[i]) * 0x10 + CHR_MAP_UNSIGNED; // get the location of the first tile slice in memory
-			}
-			else // signed characters
-			{
-				chrLocStart = static_cast<ubyte>(mem[i]) * 0x10 + CHR_MAP_SIGNED; // get the location of the first tile slice in memory
-			}
-			for (int i = chrLocStart; i < chrLocStart + 0x10; i += 2) // note the += 2
-			{
-				drawBGSlice(mem[i], mem[i + 1], x, y); // draw the slice
-			}
-			x += 8;
-			y -= 8;
-			if (x == SCR_BUFFER_WIDTH)
-			{
-				y += 8;
-				x = 0;
-			}
-		}
+		SDL_Delay(static_cast<Uint32>((frameDue - now) * 1000 / frequency));
 	}
 }
 
-void Gameboy::drawSprites(const std::vector<byte>& mem)
+#ifdef DEBUG
+void Gameboy::toggleBGView()
 {
-	const byte lcdc = cpu.rByte(LCDC);
-	// sprite size: 1 = 8x16, 0 = 8x8
-	if ((lcdc & b2) != 0x0)  // 8x16 wxh, 2 8x8 sprites stacked on top of each other
+	if (bgWindow != nullptr)
 	{
-		for (int i = OAM; i < OAM_END; i += 4)
-		{
-			/* sprite are offset on the Gameboy hardware by (-8, -16) 
-			 * so a sprite at (0, 0) is offscreen and actually at (-8, -16)
-			 */
-			unsigned int y = (mem[i] & 0xFF) - 16; // emulate that offset here
-			unsigned int x = (mem[i + 1] & 0xFF) - 8; // ... 
-			// sprites are always unsigned
-			// draw the upper 8x8 tile
-			addr16 chrLocStartUp = static_cast<ubyte>(mem[i + 2]) * 0x10 + CHR_MAP_UNSIGNED; // get the location of the first tile slice in memory
-			for (int j = chrLocStartUp; j < chrLocStartUp + 0x10; j += 2)
-			{
-				drawSpriteSlice(mem[j], mem[j + 1], x, y);
-			}
-			// draw the lower 8x8 tile
-			addr16 chrLocStartLow = chrLocStartUp + 0x10;
-			for (int j = chrLocStartLow; j < chrLocStartLow + 0x10; j += 2)
-			{
-				drawSpriteSlice(mem[j], mem[j + 1], x, y);
-			}
-		}
-
+		SDL_DestroyTexture(bgTexture);
+		SDL_DestroyRenderer(bgRenderer);
+		SDL_DestroyWindow(bgWindow);
+		bgTexture = nullptr;
+		bgRenderer = nullptr;
+		bgWindow = nullptr;
+		return;
 	}
-	else // 8x8
+	bgWindow = SDL_CreateWindow("gbemu - background", SDL_WINDOWPOS_UNDEFINED, SDL_WINDOWPOS_UNDEFINED, BG_SIZE * 2, BG_SIZE * 2, SDL_WINDOW_RESIZABLE);
+	bgRenderer = SDL_CreateRenderer(bgWindow, -1, SDL_RENDERER_SOFTWARE); // no vsync, it would hold up the main window
+	bgTexture = SDL_CreateTexture(bgRenderer, SDL_PIXELFORMAT_ARGB8888, SDL_TEXTUREACCESS_STREAMING, BG_SIZE, BG_SIZE);
+	if (bgWindow == nullptr || bgRenderer == nullptr || bgTexture == nullptr)
 	{
-		for (int i = OAM; i < OAM_END; i += 4)
-		{
-			unsigned int y = (mem[i] & 0xFF) - 16;
-			unsigned int x = (mem[i + 1] & 0xFF) - 8;
-			// sprites are always unsigned
-			addr16 chrLocStart = static_cast<ubyte>(mem[i + 2]) * 0x10 + CHR_MAP_UNSIGNED; // get the location of the first tile slice in memory
-			for (int j = chrLocStart; j < chrLocStart + 0x10; j += 2)
-			{
-				drawSpriteSlice(mem[j], mem[j + 1], x, y);
-			}
-		}
+		std::cout << "Background view could not be created. Error: " << SDL_GetError() << std::endl;
+		toggleBGView();
+		return;
 	}
+	SDL_RenderSetLogicalSize(bgRenderer, BG_SIZE, BG_SIZE);
 }
 
-void Gameboy::renderFull()
+void Gameboy::drawBGView()
 {
-	// clear everything
-	clear(backgroundSurface);
-	clear(fullScreenSurface);
-	const byte lcdc = cpu.rByte(LCDC); // get the current state of the lcd status register
- 	if ((lcdc & b7) != 0x0) // LCD is enabled, do drawing
+	const ubyte lcdc = cpu.rByte(LCDC);
+	const ubyte* background = ppu.background((lcdc & lcdcBGMap) != 0x0 ? 1 : 0); // only the tiles that changed are redrawn
+	void* pixels;
+	int pitch;
+	if (SDL_LockTexture(bgTexture, nullptr, &pixels, &pitch) == 0)
 	{
-		// get a dump of the cpu's memory (gfx data is stored in this memory)
-		const std::vector<byte> mem = *cpu.dumpMem();
-		// draw background first
-		if ((lcdc & 0x1) != 0x0) // draw background?
-		{
-			drawBG(mem);
-		}
-		// get the scroll x and y positions
-		srcSurfaceRect.x = static_cast<ubyte>(cpu.rByte(SCX));
-		srcSurfaceRect.y = static_cast<ubyte>(cpu.rByte(SCY));
-
-		/* emulate background wrapping in the worst way possible
-		   if the scroll reaches the end of the background, scroll it back to the beginning
-		*/
-		if (srcSurfaceRect.x >= SCR_BUFFER_WIDTH - WINDOW_WIDTH) // if the scroll reaches the end of the background
-		{
-			int mod = srcSurfaceRect.x / (SCR_BUFFER_WIDTH - WINDOW_WIDTH); // get the multiplication modifier (when SCX >= 192 the * 2 adjusts down)
-			srcSurfaceRect.x =  srcSurfaceRect.x - (SCR_BUFFER_WIDTH - WINDOW_WIDTH) * mod; // scroll it back (x - 96) 96 is when the window reaches the end of the buffer horizontally
-		}
-		if (srcSurfaceRect.y >= SCR_BUFFER_HEIGHT - WINDOW_HEIGHT)
-		{
-			int mod = srcSurfaceRect.y / (SCR_BUFFER_HEIGHT - WINDOW_HEIGHT); // get the multiplication modifier (when SCX >= 192 the * 2 adjusts down)
-			srcSurfaceRect.y = srcSurfaceRect.y - (SCR_BUFFER_HEIGHT - WINDOW_HEIGHT) * mod; // scroll it back (y - 112) 112 is when the window reaches the end of the buffer vertically
-		}
-		// copy the screen buffer (the background) to the actual screen
-		SDL_BlitSurface(backgroundSurface, &srcSurfaceRect, fullScreenSurface, NULL);
-		// draw sprites on top of background 
-		if ((lcdc & b1) != 0x0) // draw sprites?
+		const ubyte bgp = cpu.rByte(BGP);
+		ubyte row[BG_SIZE];
+		for (int y = 0; y < BG_SIZE; y++)
 		{
-			drawSprites(mem);
+			applyPalette(&background[y * BG_SIZE], BG_SIZE, bgp, row);
+			expandPixels(row, BG_SIZE, shadeColors, reinterpret_cast<uint32_t*>(static_cast<ubyte*>(pixels) + y * pitch));
 		}
-		//SDL_BlitSurface(backgroundSurface, &srcSurfaceRect, fullScreenSurface, NULL);
-		// reset the LY and current scanline
-		scanline = 0;
-		cpu.wByte(LY, scanline);
+		SDL_UnlockTexture(bgTexture);
 	}
+	SDL_RenderClear(bgRenderer);
+	SDL_RenderCopy(bgRenderer, bgTexture, nullptr, nullptr);
+	SDL_RenderPresent(bgRenderer);
 }
+#endif
 
-void Gameboy::halt()
+void clear(SDL_Renderer* renderer)
 {
-	while (!cpu.rByte(IE)) // wait for interrupt
+	// clear the window to white
+	SDL_SetRenderDrawColor(renderer, WHITE, 0xFF);
+	SDL_RenderClear(renderer);
+	SDL_RenderPresent(renderer);
+}
+
+void Gameboy::stop()
+{
+	while (running && !handleEvents(idleWait))
 	{
-		// run everything except for emulation of cpu cycles
-		renderFull(); // basically just render so the vblank interrupt can be set
-		handleEvents();
 	}
-	cpu.unHalt();
+	cpu.unStop();
+	frameDue = 0;
 }
 
-void Gameboy::stop()
+void Gameboy::idle()
 {
-	while (!handleEvents())
+	if (paused || minimized)
 	{
-#ifdef DEBUG
-		std::cout << "Stopped" << std::endl; // for debugging 
-#endif // DEBUG
+		while (running && (paused || minimized))
+		{
+			handleEvents(idleWait);
+		}
+		frameDue = 0;
 	}
 }
 
-bool Gameboy::handleEvents()
+bool Gameboy::handleEvents(int wait)
 {
 	SDL_Event e;
 	int eventR;
 	bool validKeyPressed = false; // is a valid (Gameboy) key pressed?
-	while (SDL_PollEvent(&e))
+	for (bool queued = wait > 0 ? SDL_WaitEventTimeout(&e, wait) != 0 : SDL_PollEvent(&e) != 0; queued; queued = SDL_PollEvent(&e) != 0)
 	{
 		if (e.type == SDL_QUIT)
 		{
 			running = false;
 		}
+		if (e.type == SDL_WINDOWEVENT)
+		{
+			if (e.window.event == SDL_WINDOWEVENT_MINIMIZED)
+			{
+				minimized = true;
+			}
+			else if (e.window.event == SDL_WINDOWEVENT_RESTORED || e.window.event == SDL_WINDOWEVENT_MAXIMIZED)
+			{
+				minimized = false;
+			}
+		}
 		if (e.type == SDL_KEYDOWN)
 		{
 			SDL_Keycode key = e.key.keysym.sym;
+			if (key == SDLK_p && e.key.repeat == 0)
+			{
+				paused = !paused;
+			}
 #ifdef DEBUG
 			if (key == SDLK_9)
 			{
@@ -407,6 +320,10 @@ bool Gameboy::handleEvents()
 			{
 				cpu._test = false;
 			}
+			if (key == SDLK_TAB)
+			{
+				toggleBGView();
+			}
 			if (key == SDLK_g)
 			{
 				static int numChecks = 0;
@@ -6,6 +6,7 @@
 #include <string>
 
 #include "cpu.h"
+#include "ppu.h"
 #include "memdefs.h"
 #include "input.h"
 #include "types.h"
@@ -14,11 +15,9 @@
 #include "toHex.h"
 #endif
 
-#define WINDOW_WIDTH 160
-#define WINDOW_HEIGHT 144
-
-#define SCR_BUFFER_HEIGHT 256
-#define SCR_BUFFER_WIDTH 256
+#define WINDOW_SCALE 3 // the window's starting size in LCD pixels, it can be resized
+#define WINDOW_WIDTH (LCD_WIDTH * WINDOW_SCALE)
+#define WINDOW_HEIGHT (LCD_HEIGHT * WINDOW_SCALE)
 
 // These colors roughly mimick the green colors of the DMG Gameboy 
 #define BLACK 8, 24, 32
@@ -40,74 +39,77 @@ public:
 	void run();
 
 private:
-	// Draws the full screen to screenBuffer and then copies it to screensurface through the scroll registers
-	void renderFull();
-
-	/// Draws a single scanline from the screenSurface to the screenFinal and increments the current scanline
-	void drawScanline();
-
+	// The PPU's modes, the low 2 bits of STAT
+	enum LCDModes
+	{
+		lcdHBlank = 0,
+		lcdVBlank = 1,
+		lcdOAMScan = 2,
+		lcdTransfer = 3, // drawing the line
+	};
+	// Their lengths in clock cycles, a line is always LINE_CYCLES
+	static const int oamScanLen = 80;
+	static const int transferLen = 172;
+	static const int hblankLen = 204;
+
+	static const int clockSpeed = 4194304; // Hz
+	static const int frameCycles = LINE_CYCLES * NUM_LINES;
+	static const int idleWait = 100; // ms to block for input while there's nothing to emulate
+
+	// Moves the PPU on to its next mode when evLCD is due, the line is drawn as the transfer starts
+	// LY isn't kept here, the CPU works it out from the same clock
+	void lcdEvent();
+	void setLCDMode(int mode);
+
+	// Converts the finished frame to the window's pixels and displays it
+	void presentFrame();
+
+	// Sleeps until the next frame is due, frames are shown at the Gameboy's rate (~59.7 Hz) whatever the monitor's is
+	void waitForFrame();
+
+	// @param wait is how long to block for the first event in ms, 0 only handles the ones already queued
 	// @Returns true if a key valid key on the Gameboy was pressed (this is used for breaking out of the STOP command)
-	bool handleEvents(); 
-
-	// Draws a single 8 pixel slice of a background
-	// @param b1 is byte one of the slice 
-	// @param b2 is byte two of the slice
-	// @param x is the starting x coordinate to draw to
-	// @param y is the starting y coordinate to draw to
-	void drawBGSlice(const byte b1, const byte b2, unsigned& x, unsigned& y);
-
-	// Draws a single 8 pixel slice of a sprite (only difference is color = (0x0, 0x0) is clear for sprites)
-	// @param b1 is byte one of the slice
-	// @param b2 is byte two of the slice
-	// @param x is the starting x coordinate to draw to
-	// @param y is the starting y coordinate to draw to
-	void drawSpriteSlice(const byte b1, const byte b2, unsigned& x, unsigned& y);
-
-	// Draws a single pixel of color <color> to the screenbuffer at (<x>, <y>)
-	// @param dest is a pointer to the SDL_Surface to draw to
-	// @param r is the red component of the RGB color
-	// @param g is the green component of the RGB color
-	// @param b is the blue component of the RGB color
-	// @param x is the x coordinate to draw the pixel at
-	// @param y is the y coordinate to draw the pixel at
-	void drawPixel(SDL_Surface* dest, const char r, const char g, const char b, const unsigned x, const unsigned y);
-
-	// Draws all 32x32 tiles of the background
-	// @param mem is a full copy of the cpu's memory
-	void drawBG(const std::vector<byte>& mem);
-
-	// Draws all of the sprites defined in OAM
-	// Does NOT restrict number of sprites per line
-	// @param mem is a full copy of the cpu's memory
-	void drawSprites(const std::vector<byte>& mem);
-
-	// emulate CPU HALTing
-	void halt();
-	
-	// emulate CPU STOPing
+	bool handleEvents(int wait = 0);
+
+	// emulate CPU STOPing, blocks until a button is pressed
 	void stop();
 
+	// Blocks while paused or minimized
+	void idle();
+
 	bool __T = false;
 
+#ifdef DEBUG
+	// Second window showing the whole 256x256 background map LCDC selects, toggled with tab
+	void toggleBGView();
+	void drawBGView();
+
+	SDL_Window* bgWindow = nullptr;
+	SDL_Renderer* bgRenderer = nullptr;
+	SDL_Texture* bgTexture = nullptr;
+#endif
+
 private:
 	CPU cpu; // the emulated z80-like cpu of the Gameboy
+	PPU ppu; // draws the screen from the cpu's video memory
 	ubyte scanline = 0; // current scanline to draw
+	int lcdMode = lcdOAMScan;
+	uint64_t lcdEventTime = 0; // when evLCD is due
 
 	SDL_Window* window = nullptr;
-	SDL_Surface* fullScreenSurface = nullptr; // Final image surface including scrolled background and sprites 
-	SDL_Surface* backgroundSurface = nullptr; // Full 32x32 background, controlled by the scroll registers (SCX, SCY)
-	SDL_Surface* windowSurface = nullptr;  // Surface that is actually rendered to the window
+	SDL_Renderer* renderer = nullptr; // scales the frame to the window
+	SDL_Texture* frameTexture = nullptr;  // the frame, uploaded once per frame
+	uint32_t shadeColors[4]; // the frameTexture's pixel values of the 4 shades, white to black
 
 	// True while the program is running
 	bool running = true;
+	bool paused = false; // by the user, with p
+	bool minimized = false;
 
-	// these three are only here as an optimization so 3 new SDL_Rect objects arent made at a very high frequency
-	SDL_Rect srcSurfaceRect; // An SDL_Rect that represents the area and scroll coords of the window to be copied from the backgroundSurface to the fullscreenSurface
-	SDL_Rect pixel; // A pixel for rendering
-	SDL_Rect scanLineRect; // An SDL_Rect that represents the area and coords of the current scanline to copy from the fullscreenSurface to the windowSurface
+	uint64_t frameDue = 0; // when the next frame is shown in performance counter ticks, 0 to start again from now
 };
 
-/// Clears an SDL_Surface to white
-void clear(SDL_Surface*);
+/// Clears the window to white
+void clear(SDL_Renderer*);
 
 #endif // GB_GAMEBOY_H
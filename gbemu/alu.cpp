@@ -0,0 +1,120 @@
+#include "alu.h"
+
+// constexpr generators for the ALU tables
+// Flag behaviour from http://www.pastraiser.com/cpu/gameboy/gameboy_opcodes.html
+
+constexpr ubyte zeroFlag(int result)
+{
+	return (result & 0xFF) == 0 ? flagZ : 0;
+}
+
+constexpr AluResult makeResult(int result, int flags)
+{
+	return AluResult{ static_cast<ubyte>(result & 0xFF), static_cast<ubyte>(zeroFlag(result) | flags) };
+}
+
+constexpr AluResult addEntry(int c, int a, int b)
+{
+	return makeResult(a + b + c,
+		(((a & 0xF) + (b & 0xF) + c) > 0xF ? flagH : 0) |
+		((a + b + c) > 0xFF ? flagC : 0));
+}
+
+constexpr AluResult subEntry(int c, int a, int b)
+{
+	return makeResult(a - b - c,
+		flagN |
+		((a & 0xF) < (b & 0xF) + c ? flagH : 0) |
+		(a < b + c ? flagC : 0));
+}
+
+constexpr AluResult incEntry(int a)
+{
+	return makeResult(a + 1, (a & 0xF) == 0xF ? flagH : 0);
+}
+
+constexpr AluResult decEntry(int a)
+{
+	return makeResult(a - 1, flagN | ((a & 0xF) == 0x0 ? flagH : 0));
+}
+
+// @param nhc is the N, H and C flags packed as bits 2, 1 and 0
+constexpr int daaCorrection(int nhc, int a)
+{
+	return ((nhc & 0x1) || (!(nhc & 0x4) && a > 0x99) ? 0x60 : 0) |
+		   ((nhc & 0x2) || (!(nhc & 0x4) && (a & 0xF) > 0x9) ? 0x06 : 0);
+}
+
+constexpr AluResult daaEntry(int nhc, int a)
+{
+	return makeResult((nhc & 0x4) ? a - daaCorrection(nhc, a) : a + daaCorrection(nhc, a),
+		((nhc & 0x4) ? flagN : 0) |
+		((daaCorrection(nhc, a) & 0x60) ? flagC : 0));
+}
+
+constexpr bool shiftCarry(int kind, int v)
+{
+	return kind == shiftSWAP ? false :
+		   kind == shiftRLC || kind == shiftRL || kind == shiftSLA ? (v & 0x80) != 0 :
+		   (v & 0x01) != 0;
+}
+
+constexpr AluResult shiftEntry(int kind, int c, int v)
+{
+	return makeResult(shiftValue(kind, c, v), shiftCarry(kind, v) ? flagC : 0);
+}
+
+// a row of the two operand tables, b runs over J
+template<int... J>
+constexpr AluRow addRow(int c, int a, Indices<J...>)
+{
+	return AluRow{ { addEntry(c, a, J)... } };
+}
+
+template<int... J>
+constexpr AluRow subRow(int c, int a, Indices<J...>)
+{
+	return AluRow{ { subEntry(c, a, J)... } };
+}
+
+template<int... I>
+const AluRow AluTableGen<Indices<I...>>::add[2][256] =
+{
+	{ addRow(0, I, Indices<I...>())... },
+	{ addRow(1, I, Indices<I...>())... },
+};
+
+template<int... I>
+const AluRow AluTableGen<Indices<I...>>::sub[2][256] =
+{
+	{ subRow(0, I, Indices<I...>())... },
+	{ subRow(1, I, Indices<I...>())... },
+};
+
+template<int... I>
+const AluResult AluTableGen<Indices<I...>>::inc[256] = { incEntry(I)... };
+
+template<int... I>
+const AluResult AluTableGen<Indices<I...>>::dec[256] = { decEntry(I)... };
+
+template<int... I>
+const AluResult AluTableGen<Indices<I...>>::daa[8][256] =
+{
+	{ daaEntry(0, I)... }, { daaEntry(1, I)... }, { daaEntry(2, I)... }, { daaEntry(3, I)... },
+	{ daaEntry(4, I)... }, { daaEntry(5, I)... }, { daaEntry(6, I)... }, { daaEntry(7, I)... },
+};
+
+template<int... I>
+const AluResult AluTableGen<Indices<I...>>::shift[8][2][256] =
+{
+	{ { shiftEntry(shiftRLC, 0, I)... }, { shiftEntry(shiftRLC, 1, I)... } },
+	{ { shiftEntry(shiftRRC, 0, I)... }, { shiftEntry(shiftRRC, 1, I)... } },
+	{ { shiftEntry(shiftRL, 0, I)... }, { shiftEntry(shiftRL, 1, I)... } },
+	{ { shiftEntry(shiftRR, 0, I)... }, { shiftEntry(shiftRR, 1, I)... } },
+	{ { shiftEntry(shiftSLA, 0, I)... }, { shiftEntry(shiftSLA, 1, I)... } },
+	{ { shiftEntry(shiftSRA, 0, I)... }, { shiftEntry(shiftSRA, 1, I)... } },
+	{ { shiftEntry(shiftSWAP, 0, I)... }, { shiftEntry(shiftSWAP, 1, I)... } },
+	{ { shiftEntry(shiftSRL, 0, I)... }, { shiftEntry(shiftSRL, 1, I)... } },
+};
+
+template struct AluTableGen<MakeIndices<256>::type>;
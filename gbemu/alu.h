@@ -0,0 +1,122 @@
+#ifndef GB_ALU_H
+#define GB_ALU_H
+
+#include <array>
+
+#include "types.h"
+#include "indices.h"
+
+// Bits of the flag register (F)
+enum Flags
+{
+	flagZ = 0x80, // zero
+	flagN = 0x40, // subtract
+	flagH = 0x20, // half carry
+	flagC = 0x10, // carry
+};
+
+// The result of an 8 bit ALU operation along with the full F byte it produces
+struct AluResult
+{
+	ubyte result;
+	ubyte flags;
+};
+
+// Kinds of shift/ rotate, in the order of the 0xCB opcode rows
+enum ShiftKinds
+{
+	shiftRLC = 0,
+	shiftRRC,
+	shiftRL,
+	shiftRR,
+	shiftSLA,
+	shiftSRA,
+	shiftSWAP,
+	shiftSRL,
+};
+
+// The other 8 bit ALU operations, numbered after ShiftKinds so one int can name either
+enum AluOps
+{
+	aluAdd = shiftSRL + 1, // add, adc
+	aluSub, // sub, sbc, cp
+	aluInc,
+	aluDec,
+	aluAnd,
+	aluXor,
+	aluOr,
+};
+
+// The (unmasked) result of a shift/ rotate of v with carry in c
+constexpr int shiftValue(int kind, int c, int v)
+{
+	return kind == shiftRLC ? (v << 1) | (v >> 7) :
+		   kind == shiftRRC ? (v >> 1) | (v << 7) :
+		   kind == shiftRL ? (v << 1) | c :
+		   kind == shiftRR ? (v >> 1) | (c << 7) :
+		   kind == shiftSLA ? v << 1 :
+		   kind == shiftSRA ? (v >> 1) | (v & 0x80) :
+		   kind == shiftSWAP ? ((v & 0x0F) << 4) | (v >> 4) :
+		   v >> 1; // srl
+}
+
+typedef std::array<AluResult, 256> AluRow;
+
+template<typename>
+struct AluTableGen;
+
+// Precomputed results and flags for the 8 bit ALU operations
+// The entries are generated at compile time (see alu.cpp) so every lookup is a single load
+template<int... I>
+struct AluTableGen<Indices<I...>>
+{
+	static const AluRow add[2][256]; // [carry in][a][b] - add, adc
+	static const AluRow sub[2][256]; // [carry in][a][b] - sub, sbc, cp
+	static const AluResult inc[256]; // flags do not include carry, which inc leaves unchanged
+	static const AluResult dec[256]; // ...
+	static const AluResult daa[8][256]; // [N H C][a]
+	static const AluResult shift[8][2][256]; // [ShiftKinds][carry in][val]
+};
+
+typedef AluTableGen<MakeIndices<256>::type> AluTables;
+
+extern template struct AluTableGen<MakeIndices<256>::type>;
+
+// Looks up the result and flags of an 8 bit ALU operation
+// @param op is one of ShiftKinds or AluOps, when it is a constant the switch folds away
+// @param a is the first (or only) operand
+// @param b is the second operand
+// @param c is the carry in
+inline AluResult aluLookup(int op, ubyte a, ubyte b, int c)
+{
+	switch (op)
+	{
+		case aluAdd: return AluTables::add[c][a][b];
+		case aluSub: return AluTables::sub[c][a][b];
+		case aluInc: return AluTables::inc[a];
+		case aluDec: return AluTables::dec[a];
+		case aluAnd: return AluResult{ static_cast<ubyte>(a & b), static_cast<ubyte>(flagH | ((a & b) ? 0 : flagZ)) };
+		case aluXor: return AluResult{ static_cast<ubyte>(a ^ b), static_cast<ubyte>((a ^ b) ? 0 : flagZ) };
+		case aluOr:  return AluResult{ static_cast<ubyte>(a | b), static_cast<ubyte>((a | b) ? 0 : flagZ) };
+		default: return AluTables::shift[op][c][a];
+	}
+}
+
+// The result of an 8 bit ALU operation computed directly, without the flags
+// Used when the flags are evaluated lazily (see LAZY_FLAGS in cpu.h)
+inline ubyte aluValue(int op, ubyte a, ubyte b, int c)
+{
+	switch (op)
+	{
+		case aluAdd: return a + b + c;
+		case aluSub: return a - b - c;
+		case aluInc: return a + 1;
+		case aluDec: return a - 1;
+		case aluAnd: return a & b;
+		case aluXor: return a ^ b;
+		case aluOr:  return a | b;
+		default: return static_cast<ubyte>(shiftValue(op, c, a));
+	}
+}
+
+#endif // GB_ALU_H
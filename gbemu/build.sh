@@ -1 +1 @@
-g++ cpu.h Gameboy.h memdefs.h types.h input.h cpu.cpp Gameboy.cpp main.cpp -std=c++11 -lSDL2 -o ../build/gbemu
+g++ cpu.h Gameboy.h memdefs.h types.h input.h cart.h memmap.h romfile.h savefile.h mbc.h ppu.h pixels.h scheduler.h indices.h alu.h cpu.cpp cart.cpp romfile.cpp savefile.cpp mbc.cpp ppu.cpp pixels.cpp scheduler.cpp alu.cpp Gameboy.cpp main.cpp -std=c++11 -pthread -lSDL2 -o ../build/gbemu
\ No newline at end of file
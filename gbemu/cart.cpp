@@ -1,202 +1,101 @@
 #include "cart.h"
 
-void Cart::init(const char* ROMstr, int filesize)
+void Cart::init(std::shared_ptr<const ROMFile> rom, const std::string& saveFileName, MemoryMap* memMap)
 {
-	setupMBC(ROMstr);
-	initROM(ROMstr, filesize);
-	initRAM();
-}
-
-inline bool isInternalMem(const addr16 addr)
-{
-	return (addr >= INTERNAL_MEM);
-}
+	this->rom = rom;
+	setupMBC(rom->data());
 
-bool isCartROM(const addr16 addr)
-{
-	if (!isInternalMem(addr) && addr >= ROM_BANK_N && addr <= ROM_BANK_N_END ||
-		addr >= ROM_BANK_0 && addr <= ROM_BANK_0_END ||
-		addr <= ROM_BANK_0)
+	// the bank count comes from the file so a bad header can't map past its end
+	const int numROMBanks = static_cast<int>(rom->size() / banksize);
+	if (numROMBanks * banksize < romsize)
 	{
-		return true;
+		std::cout << "ROM is smaller than its header says: " << rom->size() << " bytes" << std::endl;
 	}
-	return false;
-}
 
-bool isBankedROM(const addr16 addr) 
-{
-	if (addr >= ROM_BANK_0 && addr <= ROM_BANK_0_END ||
-		addr <= ROM_BANK_0)
+	// MBC2 has 512 x 4 bits built in
+	const size_t ramSize = (type == ROM_MBC2 || type == ROM_MBC2_BATT) ? 0x200 : getRAMSize(ramsize);
+	if (hasBattery(type) && ramSize != 0 && save.open(saveFileName, ramSize))
 	{
-		return false;
-	}
-	return true;
-}
-
-bool isCartRAM(const addr16 addr)
-{
-	if (!isInternalMem(addr) && addr >= 0xA000 && addr <= 0xCFFF)
-	{
-		return true;
-	}
-	return false;
-}
-
-const byte Cart::rByte(addr16 addr) const
-{
-	if (isCartROM(addr))
-	{
-		if (isBankedROM(addr))
+		ram.data = save.data();
+		if (save.writesBack())
 		{
-			const addr16 cpy = addr;
-			addr -= banksize; // calculate the actual address in the banked rom
-			return bankedROM[currentROMBank][addr];
+			ram.save = &save;
+			ram.dirty.assign((ramSize + PAGE_SIZE - 1) / PAGE_SIZE, false);
 		}
 		else
 		{
-			return fixedROM[addr];
+			std::cout << "save file " << saveFileName << " is in use by another cart, this one won't be saved" << std::endl;
 		}
 	}
-	else if (RAMBankEnabled)
-	{
-		std::cout << "reading from ram" << std::endl;
-		std::cout << "addr = " << toHex(addr) << std::endl;
-		system("pause");
-		return bankedRAM[currentRAMBank][addr];
-	}
-}
-
-byte* Cart::gByte(addr16 addr)
-{
-	if (isCartROM(addr))
+	else
 	{
-		if (isBankedROM(addr))
-		{
-			const addr16 cpy = addr;
-			addr -= banksize; // calculate the actual address in the banked rom
-			return &bankedROM[currentROMBank][addr];
-		}
-		else
+		if (hasBattery(type) && ramSize != 0)
 		{
-			return &fixedROM[addr];
+			std::cout << "couldn't open save file " << saveFileName << ", the game won't be saved" << std::endl;
 		}
+		ramBuffer.assign(ramSize, 0);
+		ram.data = ramBuffer.data();
 	}
-	else if (RAMBankEnabled)
+	ram.size = ramSize;
+
+	mbc = createMBC(type, rom->data(), numROMBanks, ram, memMap);
+	if (mbc == nullptr)
 	{
-		std::cout << "reading from ram" << std::endl;
-		std::cout << "addr = " << toHex(addr) << std::endl;
-		system("pause");
-		return &bankedRAM[currentRAMBank][addr];
+		std::cout << "unsupported cart type: " << toHex(type) << ", treating it as ROM only" << std::endl;
+		mbc = createMBC(ROM_ONLY, rom->data(), numROMBanks, ram, memMap);
 	}
+	mbc->map();
 }
 
-void Cart::wByte(const addr16 addr, byte val)
+byte Cart::rByte(addr16 addr) const
 {
-	if (isCartROM(addr))
-	{
-		switch (type)
-		{
-			case ROM_MBC1:
-			case ROM_MBC1_RAM:
-			case ROM_MBC1_RAM_BATT:
-			{
-				if (addr >= 0x6000 && addr <= 0x7FFF)
-				{
-					// switch memory mode
-					std::cout << "switching memory mode" << std::endl;
-					std::cout << "previous memory mode = " << toHex(memMode) << std::endl;
-					if (val == 0x00)
-					{
-						memMode = memmodes::ROM_BANK;
-					}
-					else
-					{
-						memMode = memmodes::RAM_BANK;
-					}
-					std::cout << "new memory mode = " << toHex(memMode) << std::endl;
-				}
-				if (addr >= 0x2000 && addr <= 0x3FFF)
-				{
-					currentROMBank = val & 0x1F;
-					if ((val & 0x1F) == 0 || (val & 0x1F) == 1)
-					{
-						currentROMBank = 1;
-					}
-					if (memMode == memmodes::ROM_BANK)
-					{
-						currentROMBank |= upperROMBankBits;
-					}
-					std::cout << "Switched to rom bank #" << currentROMBank << std::endl;
-					system("pause");
-				}
-				if (memMode == memmodes::RAM_BANK)
-				{
-					if (addr >= 0x4000 && addr <= 0x5FFF)
-					{
-						if (memMode == memmodes::RAM_BANK)
-						{
-							currentRAMBank = val & 0x3;
-						}
-					}
-					if (addr >= 0x0000 && addr <= 0x1FFF)
-					{
-						if ((val & 0xA) == 0xA)
-						{
-							RAMBankEnabled = true;
-						}
-						else
-						{
-							RAMBankEnabled = false;
-						}
-					}
-				}
-				else if (memMode == memmodes::ROM_BANK)
-				{
-					if (addr >= 0x4000 && addr <= 0x5FFF)
-					{
-						upperROMBankBits = ((val & 0x3) << 5) & 0x60;
-						std::cout << "setting ROM address lines with: " << toHex(val) << std::endl;
-						system("pause");
-					}
-				}
-				break;
-			}
-		}
+	return mbc != nullptr ? mbc->read(addr) : static_cast<byte>(0xFF);
+}
 
-		//std::cout << "bank switching" << std::endl;
-		//std::cout << "writing value: " << toHex(val) << "\tto " << toHex(addr) << std::endl;
-		//system("pause");
-	}
-	else if (RAMBankEnabled)
+void Cart::wByte(addr16 addr, byte val)
+{
+	if (mbc != nullptr)
 	{
-		bankedRAM[currentRAMBank][addr] = val;
+		mbc->write(addr, val);
 	}
 }
 
-void Cart::wWord(const addr16 addr, word val)
+void Cart::flushRAM()
 {
-	if (isCartRAM(addr) && RAMBankEnabled)
+	if (mbc != nullptr)
 	{
-		bankedRAM[currentRAMBank][addr] = val & 0x00FF; // lower byte
-		bankedRAM[currentRAMBank][addr + 1] = ((val & 0xFF00) >> 8) & 0xFF; // upper byte
+		mbc->flushRAM();
 	}
-	else
-	{
-		std::cout << "attempting to write word to cart ROM" << std::endl;
-		std::cout << "addr = " << toHex(addr) << "\tval = " << toHex(val) << std::endl;
-		system("pause");
+}
+
+bool hasBattery(int type)
+{
+	switch (type)
+	{
+		case ROM_MBC1_RAM_BATT:
+		case ROM_MBC2_BATT:
+		case ROM_RAM_BATT:
+		case ROM_MM01_SRAM_BATT:
+		case ROM_MBC3_TIMER_BATT:
+		case ROM_MBC3_TIMER_RAM_BATT:
+		case ROM_MBC3_RAM_BATT:
+		case ROM_MBC5_RAM_BATT:
+		case ROM_MBC5_RUMLE_SRAM_BATT:
+			return true;
+		default:
+			return false;
 	}
 }
 
-void Cart::setupMBC(const char* ROMstr)
+void Cart::setupMBC(const byte* ROMstr)
 {
-	const char* romTitle = &ROMstr[TITLE];
+	const std::string romTitle(reinterpret_cast<const char*>(&ROMstr[TITLE]), TITLE_END + 1 - TITLE);
 	std::cout << "ROM <" << romTitle << "> loaded succesfuly" << std::endl;
 	std::cout << "Cart type: " << toHex(ROMstr[CART_TYPE]) << std::endl;
 	std::cout << "Cart ROM size: " << toHex(ROMstr[CART_ROM_SIZE]) << std::endl;
 	std::cout << "Cart RAM size: " << toHex(ROMstr[CART_RAM_SIZE]) << std::endl;
 
-	type = ROMstr[CART_TYPE];
+	type = static_cast<ubyte>(ROMstr[CART_TYPE]);
 	isGBC = ROMstr[SGB_COMPAT];
 	isGBC = ROMstr[GBC_COMPAT];
 	
@@ -207,104 +106,6 @@ void Cart::setupMBC(const char* ROMstr)
 	std::cout << ramsize << std::endl;
 }
 
-void Cart::initROM(const char* ROMstr, int filesize)
-{
-	fixedROM.resize(banksize);
-	currentROMBank = 0;
-	const char sizeinfo = ROMstr[CART_ROM_SIZE];
-	int numBanks = 0;
-
-	switch (sizeinfo)
-	{
-		case 0x00:
-			numBanks = 1;
-			break;
-		case 0x01:
-			numBanks = 3;
-			break;
-		case 0x02: 
-			numBanks = 7;
-			break;
-		case 0x03:
-			numBanks = 15;
-			break;
-		case 0x04:
-			numBanks = 31;
-			break;
-		case 0x05:
-			numBanks = 63;
-			break;
-		case 0x06:
-			numBanks = 127;
-			break;
-		case 0x52:
-			numBanks = 71;
-			break;
-		case 0x53:
-			numBanks = 79;
-			break;
-		case 0x54:
-			numBanks = 95;
-			break;
-		default:
-			std::cout << "unknown bank #: " << toHex(sizeinfo) << std::endl;
-			system("pause");
-			break;
-	}
-	bankedROM.resize(numBanks);
-	int rompos = 0;
-	int filepos = 0;
-	for (rompos = 0; rompos < banksize; rompos++, filepos++)
-	{
-		fixedROM[rompos] = ROMstr[filepos];
-	}
-
-	for (int i = 0; i < numBanks; i++) // 1 bank is fixed
-	{
-		for (rompos = 0; rompos < banksize; rompos++, filepos++)
-		{
-			bankedROM[i][rompos] = ROMstr[filepos];
-			currentROMBank = 0;
-		}
-	}
-}
-
-void Cart::initRAM()
-{
-	switch (ramsize)
-	{
-		case 0x00:
-			bankedRAM.resize(0);
-			break;
-		case 0x01:
-			bankedRAM.resize(1);
-			bankedRAM[0].resize(KBitToByte(16));
-			break;
-		case 0x02:
-			bankedRAM.resize(1);
-			bankedRAM[0].resize(KBitToByte(64));
-			break;
-		case 0x03:
-		{
-			bankedRAM.resize(4);
-			for (int i = 0; i < 4; i++)
-			{
-				bankedRAM[i].resize(KBitToByte(256 / 4));
-			}
-			break;
-		}
-		case 0x04:
-		{
-			bankedRAM.resize(16);
-			for (int i = 0; i < 16; i++)
-			{
-				bankedRAM[i].resize(1024 / 16);
-			}
-			break;
-		}
-	}
-}
-
 int getROMSize(const char size)
 {
 	switch (size)
@@ -344,6 +145,7 @@ int getROMSize(const char size)
 			system("pause");
 			break;
 	}
+	return 0;
 }
 
 int getRAMSize(const char size)
@@ -365,9 +167,13 @@ int getRAMSize(const char size)
 		case 0x04: // 16 banks
 			return MBitToByte(1);
 			break;
+		case 0x05: // 8 banks
+			return KBitToByte(512);
+			break;
 		default:
 			std::cout << "unknown RAM size: " << toHex(size) << std::endl;
 			system("pause");
 			break;
 	}
+	return 0;
 }
\ No newline at end of file
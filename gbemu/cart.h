@@ -7,6 +7,9 @@
 
 #include "memdefs.h"
 #include "types.h"
+#include "memmap.h"
+#include "romfile.h"
+#include "mbc.h"
 #include <string>
 
 #include "toHex.h"
@@ -26,24 +29,22 @@ const int banksize = 0x4000; // bytes
 class Cart
 {
 public:
-	void init(const char* romStr, int filesize);
-	const byte rByte(addr16 addr) const;
-	byte* gByte(addr16);
-	void wByte(const addr16 addr, byte val);
+	// @param saveFileName is where battery backed RAM is kept
+	// @param memMap is the CPU's memory map, the cart's controller maps its ROM and RAM banks into it
+	void init(std::shared_ptr<const ROMFile> rom, const std::string& saveFileName, MemoryMap* memMap);
+	// Reads and writes that reach the cart are the ones its controller left unmapped
+	byte rByte(addr16 addr) const;
+	void wByte(addr16 addr, byte val);
 
-	void wWord(const addr16 addr, word val);
+	// Starts writing the battery backed RAM written since the last flush back to the save file
+	void flushRAM();
 
 private:
-	std::vector<byte> fixedROM;
-
-	std::vector<std::array<byte, banksize>> bankedROM;
-	int currentROMBank;
-	byte upperROMBankBits;
-
-	std::vector<std::vector<byte>> bankedRAM;
-	int currentRAMBank;
-	bool RAMBankEnabled = false;
-	int memMode;
+	std::shared_ptr<const ROMFile> rom; // shared with every other cart of the same ROM
+	CartRAM ram;
+	std::vector<byte> ramBuffer; // ram without a battery
+	SaveFile save; // ... with a battery
+	std::unique_ptr<MBC> mbc;
 
 	// cart info
 	int isGBC;
@@ -52,18 +53,12 @@ private:
 	int ramsize;
 	int type;
 
-	void initROM(const char* ROMstr, int filesize);
-	void initRAM();
-	void setupMBC(const char* ROMstr);
+	void setupMBC(const byte* ROMstr);
 };
 
 int getROMSize(const char size);
 int getRAMSize(const char size);
-
-bool isCartRAM(const addr16 addr);
-inline bool isInternalMem(const addr16 addr);
-bool isCartROM(const addr16 addr);
-bool isBankedROM(const addr16 addr);
+bool hasBattery(int type);
 
 enum memmodes
 {
@@ -21,9 +21,9 @@ const int clockTimes[256] =
 };
 
 CPU::CPU() 
-	: internalmem(MEM_SIZE)
 {
 	keyInfo = { { 0x0F, 0x0F }, 0x0 };
+	mapMemory();
 	reset();
 }
 
@@ -35,231 +35,92 @@ CPU::~CPU()
 void CPU::reset()
 {
 	// initialize all mem to 0
-	for (int i = 0; i < MEM_SIZE; i++)
-	{
-		internalmem[i] = 0;
-	}
+	memset(&internalmem, 0, sizeof(internalmem));
+	scheduler.clear();
 	// some known starting values of registers
 	A = 0x01;
-	F = 0xB0;
+	setFlags(0xB0);
 	BC(0x13);
 	DE(0xD8);
 	HL(0x14D);
 	SP = 0xFFFE;
 	PC = 0x100;
 	// set memory registers to their known starting values
-	internalmem[TIMA] = 0x00;
-	internalmem[TMA] = 0x00;
-	internalmem[TAC] = 0x00;
-	internalmem[NR10] = 0x80;
-	internalmem[NR11] = 0xBF;
-	internalmem[NR12] = 0xF3;
-	internalmem[NR14] = 0xBF;
-	internalmem[NR21] = 0x3F;
-	internalmem[NR22] = 0x00;
-	internalmem[NR24] = 0xBF;
-	internalmem[NR30] = 0x7F;
-	internalmem[NR31] = 0xFF;
-	internalmem[NR32] = 0x9F;
-	internalmem[NR33] = 0xBF;
-	internalmem[NR41] = 0xFF;
-	internalmem[NR42] = 0x00;
-	internalmem[NR43] = 0x00;
-	internalmem[NR30] = 0xBF;
-	internalmem[NR50] = 0x77;
-	internalmem[NR51] = 0xF3;
-	internalmem[NR52] = 0xF1;
-	internalmem[LCDC] = 0x91;
-	internalmem[SCY] = 0x00;
-	internalmem[SCX] = 0x00;
-	internalmem[LYC] = 0x00;
-	internalmem[BGP] = 0xFC;
-	internalmem[OBP0] = 0xFC;
-	internalmem[OBP1] = 0xFF;
-	internalmem[WY] = 0x00;
-	internalmem[WX] = 0x00;
-	internalmem[IE] = 0x00;
-	internalmem[LY] = 0x94;
-}
-
-#pragma region FlagFuncs
-
-void CPU::updateCarry(uint16_t newVal)
-{
-	if (newVal & 0x1000)
-	{
-		setCarry();
-	}
-	else
-	{
-		resetCarry();
-	}
-}
-
-void CPU::resetCarry()
-{
-	F &= 0xFE;
-}
-
-void CPU::setCarry()
-{
-	F |= 0x1;
-}
-
-void CPU::updateHC(byte prevVal, byte newVal)
-{
-	if ((prevVal & b3) != (newVal & b4) && (newVal & b4))
-	{
-		setHC();
-	}
-	else
-	{
-		resetHC();
-	}
-}
-
-void CPU::resetHC()
-{
-	F &= 0xEF;
+	ioReg(TIMA) = 0x00;
+	ioReg(TMA) = 0x00;
+	ioReg(TAC) = 0x00;
+	ioReg(NR10) = 0x80;
+	ioReg(NR11) = 0xBF;
+	ioReg(NR12) = 0xF3;
+	ioReg(NR14) = 0xBF;
+	ioReg(NR21) = 0x3F;
+	ioReg(NR22) = 0x00;
+	ioReg(NR24) = 0xBF;
+	ioReg(NR30) = 0x7F;
+	ioReg(NR31) = 0xFF;
+	ioReg(NR32) = 0x9F;
+	ioReg(NR33) = 0xBF;
+	ioReg(NR41) = 0xFF;
+	ioReg(NR42) = 0x00;
+	ioReg(NR43) = 0x00;
+	ioReg(NR30) = 0xBF;
+	ioReg(NR50) = 0x77;
+	ioReg(NR51) = 0xF3;
+	ioReg(NR52) = 0xF1;
+	ioReg(LCDC) = 0x91;
+	ioReg(SCY) = 0x00;
+	ioReg(SCX) = 0x00;
+	ioReg(LYC) = 0x00;
+	ioReg(BGP) = 0xFC;
+	ioReg(OBP0) = 0xFC;
+	ioReg(OBP1) = 0xFF;
+	ioReg(WY) = 0x00;
+	ioReg(WX) = 0x00;
+	ioReg(IE) = 0x00;
+	updatePending();
+	divBase = clockCycles;
+	timaBase = clockCycles;
+	lcdBase = clockCycles;
 }
 
-void CPU::setHC()
-{
-	F |= 0x10;
-}
-
-void CPU::updateN(bool add)
-{
-	if (add == SUB) { F |= 0x2; }
-	else { F &= 0xFD; }
-}
+#pragma region OpFuncs
 
-void CPU::resetN()
-{
-	F &= 0xFD;
-}
+// the 8 bit arithmetic results and flags come from the precomputed tables in alu.cpp
 
-void CPU::setN()
+template<int op>
+inline ubyte CPU::alu(ubyte a, ubyte b, int c, ubyte mask, ubyte keep)
 {
-	F |= 0x2;
+#ifdef LAZY_FLAGS
+	lazyFlags.op = op;
+	lazyFlags.a = a;
+	lazyFlags.b = b;
+	lazyFlags.c = c;
+	lazyFlags.mask = mask;
+	lazyFlags.keep = keep;
+	lazyFlags.pending = true;
+	return aluValue(op, a, b, c);
+#else
+	const AluResult res = aluLookup(op, a, b, c);
+	F = (res.flags & mask) | keep;
+	return res.result;
+#endif
 }
 
-void CPU::updateZero(reg16 reg)
+#ifdef LAZY_FLAGS
+ubyte CPU::flags() const
 {
-	if (reg == 0)
-	{
-		setZero();
-	}
-	else
+	if (lazyFlags.pending)
 	{
-		resetZero();
+		const AluResult res = aluLookup(lazyFlags.op, lazyFlags.a, lazyFlags.b, lazyFlags.c);
+		return (res.flags & lazyFlags.mask) | lazyFlags.keep;
 	}
+	return F;
 }
-
-void CPU::resetZero()
-{
-	F &= 0xBF;
-}
-
-void CPU::setZero()
-{
-	F |= 0x40;
-}
-
-#pragma endregion
-
-#pragma region OpFuncs
-
-void CPU::rlc(reg& val)
-{
-	byte bit7 = ((val & b7) >> 7) & b0;
-	val <<= 1;
-	F |= bit7;
-	val |= bit7;
-	resetN();
-	resetHC();
-	updateZero(val);
-}
-
-void CPU::rrc(reg& val)
-{
-	byte bit0 = val & b0;
-	val >>= 1;
-	F |= bit0;
-	val |= (bit0 << 7);
-	updateZero(val);
-	resetHC();
-	resetN();
-}
-
-void CPU::rl(reg& val)
-{
-	byte bit7 = ((val & b7) >> 7) & b0;
-	byte carryCpy = F & b0;
-	val <<= 1;
-	F |= bit7;
-	val |= carryCpy;
-	updateZero(val);
-	resetHC();
-	resetN();
-}
-
-void CPU::rr(reg& val)
-{
-	byte bit0 = val & b0;
-	byte carryCpy = F & b0;
-	val >>= 1;
-	F |= bit0;
-	val &= ~b7;
-	val |= carryCpy;
-	updateZero(val);
-	resetHC();
-	resetN();
-}
-
-void CPU::sla(reg& val)
-{
-	byte bit7 = ((val & b7) >> 7) & b0;
-	val <<= 1;
-	F |= bit7;
-	updateZero(val);
-	resetN();
-	resetHC();
-}
-
-void CPU::sra(reg& val)
-{
-	byte bit0 = val & b0;
-	val >>= 1;
-	F |= bit0;
-	updateZero(val);
-	resetN();
-	resetHC();
-}
-
-void CPU::srl(reg& val)
-{
-	byte bit0 = val & b0;
-	val >>= 1;
-	F |= bit0;
-	val &= ~b7;
-	updateZero(val);
-	resetN();
-	resetHC();
-}
+#endif
 
 void CPU::bit(reg r, ubyte bit)
 {
-	if (r & bit)
-	{
-		resetZero();
-	}
-	else
-	{
-		setZero();
-	}
-	setHC();
-	resetN();
+	setFlags((flags() & flagC) | flagH | ((r & bit) ? 0 : flagZ));
 }
 
 void CPU::res(reg& r, ubyte bit)
@@ -272,207 +133,85 @@ void CPU::set(reg& r, ubyte bit)
 	r |= bit;
 }
 
-void CPU::swap(reg& r)
-{
-	r = ((r & 0x0F) << 4 | (r & 0xF0) >> 4);
-	updateZero(r);
-	resetN();
-	resetHC();
-	resetCarry();
-}
-
-void CPU::emulateBitInstruction(ubyte opcode)
-{
-	reg* op1s[] = { &B, &C, &D, &E, &H, &L, gByte(static_cast<addr16>(HL())), &A, 
-					&B, &C, &D, &E, &H, &L, gByte(static_cast<addr16>(HL())), &A };
-	uint8_t op2;
-	bool lower = (opcode & 0x0F) < 0x8;
-
-	if (opcode >= 0x40) // instructions from 0x40-0xFF have non register,
-	{					// constant operands
-		// those operands go in order from b0-b7 with two bits per 16 byte
-		// row in the instruction table
-		// first bit is low byte 0x00-0x07
-		uint8_t op2sLo[] = { b0, b2, b4, b6 };
-		// second bit is high byte 0x08-0x0F
-		uint8_t op2sHi[] = { b1, b3, b5, b7 };
-		const int op2Index = ((opcode >> 0x4) & 0x0F) - 4;
-		if (lower)
-		{
-			op2 = op2sLo[op2Index];
-		}
-		else
-		{
-			op2 = op2sHi[op2Index];
-		}
-	}
-
-	reg& op1 = *op1s[opcode & 0x0F];
-	switch (opcode & 0xF0)
-	{
-		case 0x00:
-		{
-			if (lower)
-				rlc(op1);
-			else
-				rrc(op1);
-			break;
-		}
-		case 0x10:
-		{
-			if (lower)
-				rl(op1);
-			else
-				rr(op1);
-			break;
-		}
-		case 0x20:
-		{
-			if (lower)
-				sla(op1);
-			else
-				sra(op1);
-			break;
-		}
-		case 0x30:
-		{
-			if (lower)
-				swap(op1);
-			else
-				srl(op1);
-			break;
-		}
-		case 0x40: case 0x50: case 0x60: case 0x70:
-		{
-			bit(op1, op2);
-			break;
-		}
-		case 0x80: case 0x90: case 0xA0: case 0xB0:
-		{
-			res(op1, op2);
-			break;
-		}
-		case 0xC0: case 0xD0: case 0xE0: case 0xF0:
-		{
-			set(op1, op2);
-			break;
-		}
-	}
-	PC += 2; // all 0xCB instructions are 2 bytes long
-}
-
 void CPU::cmp(const byte val)
 {
-	updateCarry(A - val);
-	updateN(SUB);
-	updateHC(A, A - val);
-	updateZero(A - val);
+	alu<aluSub>(A, val, 0);
 	PC++;
 }
 
 void CPU::dec(byte& b)
 {
-	const byte before = b;
-	b--;
-	updateZero(b);
-	updateN(SUB);
-	updateHC(before, b);
+	b = alu<aluDec>(b, 0, 0, 0xFF, flags() & flagC); // carry is unaffected
 	PC++;
 }
 
 void CPU::inc(byte& b)
 {
-	const byte before = b;
-	b++;
-	updateZero(b);
-	updateN(ADD);
-	updateHC(before, b);
+	b = alu<aluInc>(b, 0, 0, 0xFF, flags() & flagC);
 	PC++;
 }
 
 void CPU::add(byte val)
 {
-	const byte before = A;
-	updateCarry(A + val);
-	A += val;
-	updateN(ADD);
-	updateHC(before, A);
-	updateZero(A);
+	A = alu<aluAdd>(A, val, 0);
 	PC++;
 }
 
 void CPU::adc(byte val)
 {
-	const byte before = A;
-	updateCarry(A + val + carry());
-	A += val + carry();
-	updateN(ADD);
-	updateHC(before, A);
-	updateZero(A);
+	A = alu<aluAdd>(A, val, carry());
 	PC++;
 }
 
 void CPU::sub(byte val)
 {
-	const byte before = A;
-	updateCarry(A - val);
-	A -= val;
-	updateN(SUB);
-	updateHC(before, A);
-	updateZero(A);
+	A = alu<aluSub>(A, val, 0);
 	PC++;
 }
 
 void CPU::sbc(byte val)
 {
-	const byte before = A;
-	updateCarry(A - (val + carry()));
-	A -= (val + carry());
-	updateN(SUB);
-	updateHC(before, A);
-	updateZero(A);
+	A = alu<aluSub>(A, val, carry());
 	PC++;
 }
 
 void CPU::andr(byte val)
 {
-	A &= val;
-	resetCarry();
-	resetN();
-	setHC();
-	updateZero(A);
+	A = alu<aluAnd>(A, val, 0);
 	PC++;
 }
 
 void CPU::xorr(byte val)
 {
-	A ^= val;
-	resetCarry();
-	resetN();
-	resetHC();
-	updateZero(A);
+	A = alu<aluXor>(A, val, 0);
 	PC++;
 }
 
 void CPU::orr(byte val)
 {
-	A |= val;
-	resetCarry();
-	resetN();
-	resetHC();
-	updateZero(A);
+	A = alu<aluOr>(A, val, 0);
 	PC++;
 }
 
-// set halted flag
+// Nothing happens until an event raises an interrupt, so the clock goes straight to the next event and run keeps the CPU halted until one is pending
+// With an interrupt already pending HALT doesn't stop at all (the HALT bug isn't emulated)
 void CPU::halt()
 {
-	halted = true;
+	if (pending == 0 && scheduler.next() != UINT64_MAX)
+	{
+		halted = true;
+		clockCycles = std::max(clockCycles, scheduler.next());
+	}
 }
 
+// Like HALT but only a button press wakes it up, which the front end does with unStop
 void CPU::stop()
 {
 	stopped = true;
+	if (scheduler.next() != UINT64_MAX)
+	{
+		clockCycles = std::max(clockCycles, scheduler.next());
+	}
 }
 
 void CPU::ret(bool cond)
@@ -599,7 +338,7 @@ void CPU::dumpCPU()
 	std::cout << "C: " << toHex((byte)C) << std::endl;
 	std::cout << "D: " << toHex((byte)D) << std::endl;
 	std::cout << "E: " << toHex((byte)E) << std::endl;
-	std::cout << "F: " << toHex((byte)F) << std::endl;
+	std::cout << "F: " << toHex((byte)flags()) << std::endl;
 	std::cout << "AF: " << toHex(AF()) << std::endl;
 	std::cout << "BC: " << toHex(BC()) << std::endl;
 	std::cout << "DE: " << toHex(DE()) << std::endl;
@@ -620,1210 +359,1074 @@ static bool p = 0;
 
 #pragma region memaccess
 
-byte CPU::rByte(addr16 addr) const
+// Maps the internal memory that can be accessed without side effects
+void CPU::mapMemory()
 {
-	if (isInternalMem(addr))
+	memMap.mapRead(0x0000, WORK_RAM, nullptr); // until the cart is loaded
+	memMap.mapWrite(0x0000, WORK_RAM, nullptr); // MBC registers
+
+	const struct { addr16 start; size_t size; byte* mem; } regions[] =
 	{
-		return internalmem[addr];
+		{ CHARACTER_RAM, sizeof(internalmem.videoRAM), internalmem.videoRAM },
+		{ WORK_RAM, sizeof(internalmem.workRAM), internalmem.workRAM },
+		{ RES_RAM, RES_RAM_END + 1 - RES_RAM, internalmem.workRAM }, // echo RAM
+		{ OAM, sizeof(internalmem.oam), internalmem.oam },
+	};
+	for (const auto& region : regions)
+	{
+		memMap.mapRead(region.start, region.size, region.mem);
+		memMap.mapWrite(region.start, region.size, region.mem);
 	}
-	else
+
+	memMap.mapRead(JOYPAD, sizeof(internalmem.io), nullptr); // the timer and LCD counters are worked out when they are read
+	memMap.mapWrite(JOYPAD, sizeof(internalmem.io), nullptr); // mmio
+	mapIO();
+}
+
+void CPU::mapIO()
+{
+	for (IOHandler& handler : ioHandlers)
 	{
-		return cart.rByte(addr);
+		handler = &CPU::ioStore;
 	}
+
+	// joypad
+	ioHandlers[ioIndex(JOYPAD)] = &CPU::ioJoypad;
+
+	// timer
+	ioHandlers[ioIndex(DIV)] = &CPU::ioDIV;
+	ioHandlers[ioIndex(TIMA)] = &CPU::ioTimer;
+	ioHandlers[ioIndex(TAC)] = &CPU::ioTimer;
+
+	// serial port
+	ioHandlers[ioIndex(SC)] = &CPU::ioSerial;
+
+	// interrupts
+	ioHandlers[ioIndex(IF)] = &CPU::ioInterrupt;
+	ioHandlers[ioIndex(IE)] = &CPU::ioInterrupt;
+
+	// PPU
+	ioHandlers[ioIndex(STAT)] = &CPU::ioLCDStat;
+	ioHandlers[ioIndex(LYC)] = &CPU::ioLCDStat;
+	ioHandlers[ioIndex(DMA)] = &CPU::ioDMA;
+
+	// the APU and the rest of the PPU registers don't have any side effects yet
 }
 
-byte* CPU::gByte(addr16 addr)
+// Writes to the mmio page, the I/O registers and IE go to their handlers
+void CPU::wIO(addr16 addr, byte val)
 {
-	if (isInternalMem(addr))
+	if (addr >= HIGH_RAM && addr <= HIGH_RAM_END)
 	{
-		return &internalmem[addr];
+		ioReg(addr) = val;
 	}
 	else
 	{
-		return cart.gByte(addr);
+		(this->*ioHandlers[ioIndex(addr)])(addr, val);
 	}
 }
 
-void CPU::wByte(addr16 addr, byte val)
+void CPU::ioStore(addr16 addr, byte val)
 {
-	if (isInternalMem(addr))
-	{
-		if (addr == LYC)
-		{
-			std::cout << "write to LYC val = " << toHex(val) << std::endl;
-			std::cout << "LYC before = " << toHex(rByte(LYC)) << std::endl;
-			dumpCPU();
-			system("pause");
-		}
-		else if (addr == STAT && val != 0x0 && val != 0x4)
-		{
-			std::cout << "write to stat val = " << toHex(val) << std::endl;
-			std::cout << "stat before = " << toHex(rByte(STAT)) << std::endl;
-			dumpCPU();
-			system("pause");
-		}
+	ioReg(addr) = val;
+}
 
-		internalmem[addr] = val;
-		if (addr >= 0xC000 && addr <= 0xDE00)
-		{
-			internalmem[addr + 0x2000] = val; // emulate mirroring of RAM
-		}
-		else if (addr >= 0xE000 && addr <= 0xFE00)
-		{
-			internalmem[addr - 0x2000] = val; // emulate mirroring of RAM
-		}
+void CPU::ioJoypad(addr16 addr, byte val)
+{
+	ioReg(addr) = val;
+	keyInfo.colID = val;
+}
 
-		// specialized internal memory areas (mmio with special cases)
-		if (addr == DIV)
-		{
-			internalmem[addr] = 0x0; // any write to DIV resets it to 0
-		}
-		else if (addr == DMA) // dma
-		{
-			dma();
-		}
-		else if (addr == JOYPAD) // joypad write
-		{
-			keyInfo.colID = A;
-		}
+void CPU::ioDIV(addr16 addr, byte val)
+{
+	foldTimer();
+	divBase = clockCycles; // any write to DIV resets it to 0
+	scheduleTimer();
+}
+
+void CPU::ioTimer(addr16 addr, byte val)
+{
+	foldTimer();
+	ioReg(addr) = val; // TIMA counts on from val, or TAC changes the period from now on
+	scheduleTimer();
+}
+
+void CPU::ioLCDStat(addr16 addr, byte val)
+{
+	if (addr == STAT)
+	{
+		ioReg(STAT) = (val & ~0x7) | (ioReg(STAT) & 0x7); // the mode and coincidence bits are read only
 	}
 	else
 	{
-		std::cout << "wbyte PC = " << toHex(PC) << std::endl;
-		cart.wByte(addr, val);
+		ioReg(addr) = val;
 	}
+	scheduleLYC();
 }
 
-void CPU::wWord(addr16 addr, word val)
+// TAC's clock select is 4096, 262144, 65536 or 16384 Hz, TIMA goes up each time the divider passes a multiple of the period
+int CPU::timerPeriod() const
 {
-	if (isInternalMem(addr))
+	static const int periods[] = { 1024, 16, 64, 256 };
+	const ubyte tac = ioReg(TAC);
+	return (tac & b2) != 0x0 ? periods[tac & 0x3] : 0;
+}
+
+ubyte CPU::timer() const
+{
+	const ubyte tima = ioReg(TIMA);
+	const int period = timerPeriod();
+	if (period == 0)
 	{
-		internalmem[addr] = val & 0x00FF; // lower byte
-		internalmem[addr + 1] = ((val & 0xFF00) >> 8) & 0xFF; // upper byte
+		return tima;
 	}
-	else
+	const uint64_t ticks = (clockCycles - divBase) / period - (timaBase - divBase) / period;
+	if (tima + ticks <= 0xFF)
 	{
-		cart.wWord(addr, val);
+		return static_cast<ubyte>(tima + ticks);
 	}
+	// the overflow is due but the instruction reading it hasn't finished yet
+	return static_cast<ubyte>(ioReg(TMA) + (tima + ticks - 0x100));
 }
 
-#pragma endregion
+void CPU::foldTimer()
+{
+	ioReg(TIMA) = timer();
+	timaBase = clockCycles;
+}
 
-void CPU::dma()
+void CPU::scheduleTimer()
 {
-	const addr16 dmaStart = A << 0x8; // get the location that the DMA will be copying from
-	for (int i = 0; i < 0x8C; i++) // copy the 0x8C bytes from dmaStart to the OAM
+	const int period = timerPeriod();
+	if (period == 0)
 	{
-		internalmem[OAM + i] = rByte(dmaStart + i);
+		scheduler.cancel(evTimer);
+		return;
 	}
+	// the divider multiple that TIMA passes 0xFF on
+	const uint64_t ticks = (timaBase - divBase) / period + (0x100 - static_cast<ubyte>(ioReg(TIMA)));
+	scheduler.schedule(evTimer, divBase + ticks * period);
 }
 
-void CPU::interrupt(const byte loc)
+void CPU::timerOverflow(uint64_t when)
 {
-	push(PC); // push the program counter onto the stack
-	PC = loc; // jump to the interrupt location
-	IME = false; // disable interrupts
-	wByte(IF, 0x0);
+	ioReg(TIMA) = ioReg(TMA); // reloaded from the modulo
+	timaBase = when;
+	requestInterrupt(b2);
+	scheduleTimer();
 }
 
-void CPU::handleInterrupts()
+void CPU::startLCD()
+{
+	lcdBase = clockCycles;
+	scheduleLYC();
+}
+
+void CPU::scheduleLYC()
 {
-	const byte intEnable = rByte(IE);
-	const byte intFlag = rByte(IF);
-	if (IME) // are interrupts enabled?
+	const ubyte lyc = ioReg(LYC);
+	if ((ioReg(STAT) & b6) == 0x0 || lyc >= NUM_LINES)
 	{
-		if ((intEnable & b0) && (intFlag & b0)) // vblank DONE
-		{
-			const int vBlankInt = 0x40;
-			interrupt(vBlankInt);
-		}
-		else if ((intEnable & b1) && (intFlag & b1)) // LCDC (STAT) interrupt TODO
-		{
-			const int LCDStatInt = 0x48;
-			interrupt(LCDStatInt);
-		}
-		else if ((intEnable & b2) && (intFlag & b2)) // timer overflow TODO?
-		{
-			const int timerOverflowInt = 0x50;
-			interrupt(timerOverflowInt);
-		}
-		else if ((intEnable & b3) && (intFlag & b3)) // serial I/O transfer complete TODO
-		{
-			const int serialInt = 0x58;
-			interrupt(serialInt);
-		}
-		else if ((intEnable & b4) && (intFlag & b4)) // Transition from High to Low of Pin number P10-P13 TODO
-		{
-			const int hiToLoP10_P13 = 0x60;
-			interrupt(hiToLoP10_P13);
-		}
+		scheduler.cancel(evLYC);
+		return;
+	}
+	// the next time line LYC starts
+	const uint64_t frameCycles = LINE_CYCLES * NUM_LINES;
+	uint64_t when = lcdBase + (clockCycles - lcdBase) / frameCycles * frameCycles + lyc * LINE_CYCLES;
+	if (when <= clockCycles)
+	{
+		when += frameCycles;
 	}
+	scheduler.schedule(evLYC, when);
 }
 
-// 4194304 Hz
-// 4194304 cycles / second
-
-// 4096 Hz
-// 4096 interrupts / second
+void CPU::lycMatch(uint64_t when)
+{
+	requestInterrupt(b1); // STAT interrupt
+	scheduler.schedule(evLYC, when + LINE_CYCLES * NUM_LINES);
+}
 
-void CPU::updateTimer()
+void CPU::ioDMA(addr16 addr, byte val)
 {
-	static unsigned startTime;
-	static bool timerAlreadyStarted = false;
-	byte timerControl = rByte(TAC);
-	// is timer started or stopped?
-	if (timerControl & b2) // started
-	{
-		if (!timerAlreadyStarted) // if timer has not already been started (if it has not been running)
-		{
-			startTime = NULL; // then restart the timer
-			timerAlreadyStarted = true;
-		}
-		else // timer already running and still should be running
-		{
-			// update timer
-			const unsigned numTicks = NULL - startTime;
-			// get clock select frequency
-			const double freqs[] = { 4.096, 262.144, 65.536, 16.384 };
-			double freq = freqs[timerControl & 0x3];
-
-			// convert freqency to ticks (milliseconds)
-			double freqAsTicks = std::pow(freq, -1);
-			const ubyte tima = rByte(TIMA);
-			if (numTicks > freqAsTicks) // increment counter
-			{
-				wByte(TIMA, tima + 1);
-			}
-			// check for overflow
-			static bool willOverflow = false;
-			if (willOverflow)
-			{
-				willOverflow = false;
-				ubyte timerModulo = rByte(TMA); // When the TIMA overflows, this data will be loaded
-				wByte(TIMA, timerModulo);
+	ioReg(addr) = val;
+	dma(val);
+}
 
-				// set interrupt
-				byte intFlag = rByte(IF);
-				wByte(IF, intFlag | b2);
+void CPU::ioInterrupt(addr16 addr, byte val)
+{
+	ioReg(addr) = val;
+	updatePending();
+}
 
-				// reset the clock
-				startTime = NULL;
-			}
-			if ((tima & 0xFF) == 0xFF)
-			{
-				willOverflow = true;
-			}
-		}
+void CPU::ioSerial(addr16 addr, byte val)
+{
+	ioReg(addr) = val;
+	// a transfer on the internal clock shifts out 8 bits at 8192 Hz, there is never anything on the other end
+	if ((val & (b7 | b0)) == (b7 | b0))
+	{
+		scheduler.schedule(evSerial, clockCycles + 8 * 512);
 	}
-	else // timer stopped
+	else
 	{
-		timerAlreadyStarted = false;
+		scheduler.cancel(evSerial);
 	}
 }
 
-void CPU::emulateCycle()
+void CPU::serialDone()
 {
-	//updateTimer(); // todo: where should this go?
+	ioReg(SB) = static_cast<byte>(0xFF); // what is shifted in with no cable connected
+	ioReg(SC) &= ~b7;
+	requestInterrupt(b3);
+}
 
-	handleInterrupts();
+void CPU::setVRAMListener(VRAMListener* listener)
+{
+	vramListener = listener;
+	memMap.mapWrite(CHARACTER_RAM, sizeof(internalmem.videoRAM), listener == nullptr ? internalmem.videoRAM : nullptr);
+	memMap.mapWrite(OAM, sizeof(internalmem.oam), listener == nullptr ? internalmem.oam : nullptr);
+}
 
-	ubyte opcode = rByte(PC); // get next opcode
-	clockCycles += clockTimes[opcode];
-	emulateInstruction(opcode);
+void CPU::wVRAM(addr16 addr, byte val)
+{
+	byte& mem = internalmem.videoRAM[addr - CHARACTER_RAM];
+	if (mem != val)
+	{
+		mem = val;
+		if (vramListener != nullptr)
+		{
+			vramListener->vramWritten(addr);
+		}
+	}
 }
 
-static bool ss = false;
-static int cc = 0;
+void CPU::wOAM(addr16 addr, byte val)
+{
+	byte& mem = internalmem.oam[addr - OAM];
+	if (mem != val)
+	{
+		mem = val;
+		if (vramListener != nullptr && addr <= OAM_END)
+		{
+			vramListener->oamWritten();
+		}
+	}
+}
 
-void CPU::emulateInstruction(ubyte opcode)
+byte CPU::rByteUnmapped(addr16 addr) const
 {
-	// amida returns from timer interrupt at 
-	// 0x2e10
-	// should return to 0x2c2c
-	// instead returns to 0xa
-	// then rst 0x38 loops forever
+	if (addr >= JOYPAD) // HRAM and IE never get here, rByte reads them
+	{
+		return rIO(addr);
+	}
+	return cart.rByte(addr); // cart RAM while it is disabled or switched out for MBC3 clock registers
+}
 
-	if (PC == 0x2e10)
+byte CPU::rIO(addr16 addr) const
+{
+	switch (addr)
 	{
-		ss = true;
+		case DIV: return static_cast<byte>((clockCycles - divBase) >> 8);
+		case TIMA: return static_cast<byte>(timer());
+		case LY: return static_cast<byte>(line());
+		case STAT: return (ioReg(STAT) & ~b2) | (line() == static_cast<ubyte>(ioReg(LYC)) ? b2 : 0); // coincidence
+		default: return ioReg(addr);
 	}
+}
 
-	if (_test || ss && cc < 100)
+void CPU::wByteUnmapped(addr16 addr, byte val)
+{
+	if (addr >= JOYPAD)
 	{
-		std::cout << toHex(opcode) << "\tat " << toHex(PC) << "\n";
-		cc++;
+		wIO(addr, val);
 	}
-	else if (cc >= 100)
+	else if (addr >= CHARACTER_RAM && addr <= BG_MAP_1_END)
 	{
-		system("pause");
-		cc = 0;
+		wVRAM(addr, val);
 	}
-
-	/// emulate opcodes 0x40-0xBF (not including 0x76)
-	if ((opcode & 0xFF) >= 0x40 && (opcode & 0xFF) <= 0xBF && (opcode & 0xFF) != 0x76) // 0x76 is halt
+	else if (addr >= OAM)
+	{
+		wOAM(addr, val);
+	}
+	else
 	{
-		reg srcs[] = { B, C, D, E, H, L, rByte(static_cast<addr16>(HL())), A,
-					   B, C, D, E, H, L, rByte(static_cast<addr16>(HL())), A };
-		reg src = srcs[opcode & 0x0F];
-		const bool lower = (opcode & 0x0F) < 0x08;
+		cart.wByte(addr, val);
+	}
+}
 
-		switch (opcode & 0xF0)
-		{
-			case 0x40: case 0x50: case 0x60: case 0x70: // ld r8, o8
-			{
-				reg* dst;
+void CPU::wWord(addr16 addr, word val)
+{
+	wByte(addr, val & 0x00FF); // lower byte
+	wByte(addr + 1, ((val & 0xFF00) >> 8) & 0xFF); // upper byte
+}
 
-				const int dstIndex = ((opcode >> 0x4) & 0x0F) - 4;
+#pragma endregion
 
-				// in a single "row" of 16 instructions on an z80 instruction table
-				// there are 2 destinations, 1 in the first 8 and 1 in the second 8
-				if (lower) // low "row" operands are B, D, H, (HL)
-				{
-					reg* dstsLo[] = { &B, &D, &H, gByte(static_cast<addr16>(HL())) };
-					dst = dstsLo[dstIndex];
-				}
-				else // right "row" operands are C, E, L, A
-				{
-					reg* dstsHi[] = { &C, &E, &L, &A };
-					dst = dstsHi[dstIndex];
-				}
+void CPU::dma(ubyte src)
+{
+	const addr16 dmaStart = src << 0x8; // get the location that the DMA will be copying from
+	for (int i = 0; i < OAM_END + 1 - OAM; i++) // copy the 0xA0 bytes (all 40 sprites) from dmaStart to the OAM
+	{
+		internalmem.oam[i] = rByte(dmaStart + i);
+	}
+	if (vramListener != nullptr)
+	{
+		vramListener->oamWritten();
+	}
+}
 
-				ld8<0>(*dst, src);
-				break;
-			}
-			case 0x80:
-			{
-				if (lower) // add a, o8
-					add(src);
-				else // adc a, o8
-					adc(src);
-				break;
-			}
-			case 0x90:
-			{
-				if (lower) // sub o8
-					sub(src);
-				else // sbc a, o8
-					sub(src);
-				break;
-			}
-			case 0xA0:
-			{
-				if (lower) // and o8
-					andr(src);
-				else // xor o8
-					xorr(src);
-				break;
-			}
-			case 0xB0:
-			{
-				if (lower) // or o8
-					orr(src);
-				else // cp o8
-					cmp(src);
-				break;
-			}
-		}
-		return;
-	}
+void CPU::interrupt(const byte loc)
+{
+	push(PC); // push the program counter onto the stack
+	PC = loc; // jump to the interrupt location
+	IME = false; // disable interrupts
+}
+
+// Only called with IME set and an interrupt pending
+void CPU::handleInterrupts()
+{
+	// the lowest bit has the highest priority: vblank, LCDC (STAT), timer overflow, serial transfer complete, joypad (P10-P13 high to low)
+	const int n = lowestBit(pending);
+	ioReg(IF) &= ~(1 << n); // only the one being taken is acknowledged
+	updatePending();
+	interrupt(0x40 + n * 8);
+}
 
-	/// emulate all other opcodes
-	switch (opcode & 0xFF)
+int CPU::run()
+{
+	for (;;)
 	{
-		case 0x00: // NOP
-		{
-			PC++;
-			break;
-		}
-		case 0x01: // ld BC, **
-		{
-			ld16<1>(B, C, getNextWord());
-			break;
-		}
-		case 0x02: // ld (BC), a
-		{
-			wByte(static_cast<addr16>(BC()), A);
-			PC++;
-			break;
-		}
-		case 0x03: // inc BC
-		{
-			const reg16 bc = BC();
-			BC(bc + 1);
-			PC++;
-			break;
-		}
-		case 0x04: // inc b
-		{
-			inc(B);
-			break;
-		}
-		case 0x05: // dec b
-		{
-			dec(B);
-			break;
-		}
-		case 0x06: // ld b, *
-		{
-			B = rByte(PC + 1);
-			PC += 2;
-			break;
-		}
-		case 0x07: // rlca
-		{
-			const byte before = A;
-			updateCarry(A << 1);
-			A <<= 1;
-			resetN();
-			resetHC();
-			PC++;
-			break;
-		}
-		case 0x08: // ld (**), sp
-		{
-			std::cout << "asfsaffsdaf453" << std::endl;
-			std::cout << toHex(PC) << std::endl;
-			system("pause");
-			wWord(getNextWord(), SP);
-			PC += 3;
-			break;
-		}
-		case 0x09: // add hl, bc
-		{
-			const reg16 hl = HL();
-			HL(BC() + hl);
-			updateCarry(HL());
-			updateN(ADD);
-			updateHC(hl, HL());
-			PC++;
-			break;
-		}
-		case 0x0A: // ld a, (BC)
-		{
-			A = rByte(static_cast<addr16>(BC()));
-			PC++;
-			break;
-		}
-		case 0x0B: // dec BC
-		{
-			const reg16 bc = BC();
-			BC(bc - 1);
-			PC++;
-			break;
-		}
-		case 0x0C: // inc C
-		{
-			inc(C);
-			break;
-		}
-		case 0x0D: // dec C
-		{
-			dec(C);
-			break;
-		}
-		case 0x0E: // ld c, *
-		{
-			C = rByte(PC + 1);
-			PC += 2;
-			break;
-		}
-		case 0x0F: // rrca
-		{
-			const byte before = A;
-			updateCarry(A >> 1);
-			A >>= 1;
-			resetN();
-			resetHC();
-			PC++;
-			break;
-		}
-		case 0x10: // STOP
-		{
-			stop();
-			PC++;
-			break;
-		}
-		case 0x11: // ld de, **
-		{
-			DE(getNextWord());
-			PC += 3;
-			break;
-		}
-		case 0x12: // ld (de), a
-		{
-			wByte(static_cast<addr16>(DE()), A);
-			PC++;
-			break;
-		}
-		case 0x13: // inc de
-		{
-			const reg16 de = DE();
-			DE(de + 1);
-			PC++;
-			break;
-		}
-		case 0x14: // inc d
-		{
-			inc(D);
-			break;
-		}
-		case 0x15: // dec d
-		{
-			dec(D);
-			break;
-		}
-		case 0x16: // ld d, *
-		{
-			D = rByte(PC + 1);
-			PC += 2;
-			break;
-		}
-		case 0x17: // rla
-		{
-			const byte before = A;
-			updateCarry(A << 1);
-			A <<= 1;
-			resetN();
-			resetHC();
-			PC++;
-			break;
-		}
-		case 0x18: // jr *
-		{
-			jr(true, rByte(PC + 1), 2);
-			clockCycles -= 5;
-			break;
-		}
-		case 0x19: // add hl, de
-		{
-			const reg16 hl = HL();
-			HL(hl + DE());
-			updateCarry(HL());
-			updateN(ADD);
-			updateHC(hl, HL());
-			PC++;
-			break;
-		}
-		case 0x1A: // ld a, (de)
-		{
-			A = rByte(static_cast<addr16>(DE()));
-			PC++;
-			break;
-		}
-		case 0x1B: // dec de
-		{
-			const reg16 de = DE();
-			DE(de - 1);
-			PC++;
-			break;
-		}
-		case 0x1C: // inc e
-		{
-			inc(E);
-			break;
-		}
-		case 0x1D: // dec e
-		{
-			dec(E);
-			break;
-		}
-		case 0x1E: // ld e, *
-		{
-			E = rByte(PC + 1);
-			PC += 2;
-			break;
-		}
-		case 0x1F: // rra
-		{
-			const reg before = A;
-			updateCarry(A >> 1);
-			A >>= 1;
-			resetN();
-			resetHC();
-			PC++;
-			break;
-		}
-		case 0x20: // jr nz, *
+		if (halted && pending != 0)
 		{
-			jr(!zero(), rByte(PC + 1), 2);
-			break;
+			halted = false; // any pending interrupt wakes the CPU up, even with IME off
 		}
-		case 0x21: // ld hl, **
+		if ((halted || stopped) && scheduler.next() != UINT64_MAX)
 		{
-			HL(getNextWord());
-			PC += 3;
-			break;
+			clockCycles = std::max(clockCycles, scheduler.next());
 		}
-		case 0x22: // ldi (hl), a or ld (hl+), a
-		{
-			wByte(static_cast<addr16>(HL()), A);
-			const reg16 hl = HL();
-			HL(hl + 1);
-			PC++;
-			break;
-		}
-		case 0x23: // inc hl
-		{
-			const reg16 hl = HL();
-			HL(hl + 1);
-			PC++;
-			break;
-		}
-		case 0x24: // inc h
-		{
-			inc(H);
-			break;
-		}
-		case 0x25: // dec h
-		{
-			dec(H);
-			break;
-		}
-		case 0x26: // ld h, *
-		{
-			H = rByte(PC + 1);
-			PC += 2;
-			break;
-		}
-		case 0x27: // daa
-		{
-#ifdef DEBUG
-			std::cout << "daa" << std::endl;
-			std::cout << "Before A = " << toHex((uint16_t)A) << std::endl;
-#endif // DEBUG
-			// implementation from http://www.worldofspectrum.org/faq/reference/z80reference.htm
-			const reg before = A;
-			byte correction = 0x0;
-			if (A > 0x99 || carry())
-			{
-				correction |= 0x60;
-				setCarry();
-			}
-			else
-			{
-				correction = 0x0;
-				resetCarry();
-			}
-			if (((A & 0x0F) > 0x9) || half_carry())
-			{
-				correction |= 0x6;
-			}
-			if (!N())
-			{
-				A += correction;
-			}
-			else
-			{
-				A -= correction;
-			}
-			updateZero(A);
-			updateHC(before, A);
-			PC++;
-#ifdef DEBUG
-			std::cout << "After A = " << toHex((uint16_t)A) << std::endl;
-#endif // DEBUG
-			break;
-		}
-		case 0x28: // jr z, *
-		{
-			jr(zero(), rByte(PC + 1), 2);
-			break;
-		}
-		case 0x29: // add hl, hl
-		{
-			const reg16 hl = HL();
-			HL(hl + hl);
-			updateCarry(HL());
-			updateN(ADD);
-			updateHC(hl, HL());
-			PC++;
-			break;
-		}
-		case 0x2A: // ldi a, (hl) 
-		{
-			A = rByte(static_cast<addr16>(HL()));
-			const reg16 hl = HL();
-			HL(hl + 1);
-			PC++;
-			break;
-		}
-		case 0x2B: // dec hl
-		{
-			const reg16 hl = HL();
-			HL(hl - 1);
-			PC++;
-			break;
-		}
-		case 0x2C: // inc l
-		{
-			inc(L);
-			break;
-		}
-		case 0x2D: // dec l
-		{
-			dec(L);
-			break;
-		}
-		case 0x2E: // ld l, *
-		{
-			L = rByte(PC + 1);
-			PC += 2;
-			break;
-		}
-		case 0x2f: // cpl
-		{
-			A = ~A;
-			PC++;
-			break;
-		}
-		case 0x30: // jr nc, *
-		{
-			jr(!carry(), rByte(PC + 1), 2);
-			break;
-		}
-		case 0x31: // ld sp, **
-		{
-			SP = getNextWord();
-			PC += 3;
-			break;
-		}
-		case 0x32: // ldd (hl), a
-		{
-			wByte(static_cast<addr16>(HL()), A);
-			const reg16 hl = HL();
-			HL(hl - 1);
-			PC++;
-			break;
-		}
-		case 0x33: // inc sp
-		{
-			SP++;
-			PC++;
-			break;
-		}
-		case 0x34: // inc (hl) 
-		{
-			inc(*gByte(static_cast<addr16>(HL())));
-			break;
-		}
-		case 0x35: // dec (hl)
-		{
-			dec(*gByte(static_cast<addr16>(HL())));
-			break;
-		}
-		case 0x36: // ld (hl), *
-		{
-			wByte(static_cast<addr16>(HL()), rByte(PC + 1));
-			PC += 2;
-			break;
-		}
-		case 0x37: // scf
-		{
-			setCarry();
-			resetN();
-			resetHC();
-			PC++;
-			break;
-		}
-		case 0x38: // jr c, *
-		{
-			jr(carry(), rByte(PC + 1), 2);
-			break;
-		}
-		case 0x39: // add hl, sp
-		{
-			const reg16 hl = HL();
-			HL(hl + SP);
-			updateCarry(HL());
-			updateN(ADD);
-			updateHC(hl, HL());
-			PC++;
-			break;
-		}
-		case 0x3A: // ldd a, (hl)
-		{
-			A = rByte(static_cast<addr16>(HL()));
-			const reg16 hl = HL();
-			HL(hl - 1);
-			PC++;
-			break;
-		}
-		case 0x3B: // dec sp
-		{
-			SP--;
-			PC++;
-			break;
-		}
-		case 0x3C: // inc a
-		{
-			inc(A);
-			break;
-		}
-		case 0x3D: // dec a
-		{
-			dec(A);
-			break;
-		}
-		case 0x3E: // ld a, *
-		{
-			A = rByte(PC + 1);
-			PC += 2;
-			break;
-		}
-		case 0x3F: // ccf inverts carry
+
+		// the straight line part, the next event can move up while it runs (a transfer or timer started)
+		while (clockCycles < scheduler.next())
 		{
-			if (carry())
-			{
-				resetCarry();
-			}
-			else
+			if (pending != 0 && IME)
 			{
-				setCarry();
+				handleInterrupts();
 			}
-			PC++;
-			break;
-		}
-		case 0x76: // halt
-		{
-			halt();
-			PC++;
-			break;
-		} 
-		case 0xC0: // ret nz
-		{
-			ret(!zero());
-			break;
-		}
-		case 0xC1: // pop bc
-		{
-			BC(pop());
-			PC++;
-			break;
-		}
-		case 0xC2: // jp nz, ** 
-		{
-			jp(!zero(), getNextWord(), 3);
-			break;
+			const ubyte opcode = rByte(PC);
+			clockCycles += clockTimes[opcode];
+			emulateInstruction(opcode);
 		}
-		case 0xC3: // jp **
-		{
-			jp(true, getNextWord(), 3);
-			break;
-		}
-		case 0xC4: // call nz, ** 
-		{
-			call(!zero());
-			break;
-		}
-		case 0xC5: // push bc
-		{
-			push(BC());
-			PC++;
-			break;
-		}
-		case 0xC6: // add a, *
-		{
-			add(rByte(PC + 1));
-			PC++; // 2 byte opcode
-			break;
-		}
-		case 0xC7: // rst 0x00
-		{
-			rst(0x00);
-			break;
-		}
-		case 0xC8: // ret z
-		{
-			ret(zero());
-			break;
-		}
-		case 0xC9: // ret
-		{
-			ret(true);
-			break;
-		}
-		case 0xCA: // jp z, **
-		{
-			jp(zero(), getNextWord(), 3);
-			break;
-		}
-		case 0xCB: // BIT INSTRUCTIONS
-		{
-			emulateBitInstruction(rByte(PC + 1));
-			break;
-		}
-		case 0xCC: // call z, **
-		{
-			call(zero());
-			break;
-		}
-		case 0xCD: // call **
-		{
-			call(true);
-			break;
-		}
-		case 0xCE: // adc a, *
-		{
-			adc(rByte(PC + 1));
-			PC++;
-			break;
-		}
-		case 0xCF: // rst 0x08
-		{
-			rst(0x08);
-			break;
-		}
-		case 0xD0: // ret nc
-		{
-			ret(!carry());
-			break;
-		}
-		case 0xD1: // pop de
-		{
-			DE(pop());
-			PC++;
-			break;
-		}
-		case 0xD2: // jp nc, **
-		{
-			jp(!carry(), getNextWord(), 3);
-			break;
-		}
-		case 0xD3: // NOP
-		{
-			PC++;
-			break;
-		}
-		case 0xD4: // call nc, **
-		{
-			call(!carry());
-			break;
-		}
-		case 0xD5: // push de
-		{
-			push(DE());
-			PC++;
-			break;
-		}
-		case 0xD6: // sub *
-		{
-			sub(rByte(PC + 1));
-			PC++;
-			break;
-		}
-		case 0xD7: // rst 0x10
-		{
-			rst(0x10);
-			break;
-		}
-		case 0xD8: // ret c
-		{
-			ret(carry());
-			break;
-		}
-		case 0xD9: // reti
-		{
-			ret(true);
-			clockCycles -= 4;
-			IME = true;
-			break;
-		}
-		case 0xDA: // jp c, **
-		{
-			jp(carry(), getNextWord(), 3);
-			break;
-		}
-		case 0xDB: // in a, (*) ~!GB
-		{
-#ifdef DEBUG
-			std::cout << "Opcode not supported by Gameboy: " << toHex((int16_t)opcode) << " at " << toHex(PC) << std::endl;
-			system("pause"); // this is for debugging only
-#endif // DEBUG
-			break;
-		}
-		case 0xDC: // call c, **
-		{
-			call(carry());
-			break;
-		}
-		case 0xDD: // IX INSTRUCTIONS ~!GB
-		{
-#ifdef DEBUG
-			std::cout << "Opcode not supported by Gameboy: " << toHex((int16_t)opcode) << " at " << toHex(PC) << std::endl;
-			system("pause"); // this is for debugging only
-#endif // DEBUG
-			break;
-		}
-		case 0xDE: // sbc a, *
-		{
-			sbc(rByte(PC + 1));
-			PC++;
-			break;
-		}
-		case 0xDF: // rst 0x18
-		{
-			rst(0x18);
-			break;
-		}
-		case 0xE0: //ld (0xFF00 + n), a
-		{
-			const ubyte low = static_cast<ubyte>(rByte(PC + 1)) & 0xFF;
-			const addr16 addr = 0xFF00 + low;
-			wByte(addr, A);
-			PC += 2;
-			break;
-		}
-		case 0xE1: // pop hl
-		{
-			HL(pop());
-			PC++;
-			break;
-		}
-		case 0xE2: // ld (C), a
-		{
-			const addr16 addr = static_cast<ubyte>(C) + 0xFF00;
-			wByte(addr, A);
-			PC++;
-			break;
-		}
-		case 0xE3: // NOP
-		{
-#ifdef DEBUG
-			std::cout << "Opcode not supported by Gameboy: " << toHex((int16_t)opcode) << " at " << toHex(PC) << std::endl;
-#endif // DEBUG
-			break;
-		}
-		case 0xE4: // call po, **
-		{
-#ifdef DEBUG
-			std::cout << "Opcode not supported by Gameboy: " << toHex((int16_t)opcode) << " at " << toHex(PC) << std::endl;
-#endif // DEBUG
-			break;
-		}
-		case 0xE5: // push hl
-		{
-			push(HL());
-			PC++;
-			break;
-		}
-		case 0xE6: // and *
-		{
-			andr(rByte(PC + 1));
-			PC++;
-			break;
-		}
-		case 0xE7: // rst 0x20
-		{
-			rst(0x20);
-			break;
-		}
-		case 0xE8: // add sp, *
-		{
-			const addr16 before = SP;
-			SP += rByte(PC + 1);
-			resetZero();
-			resetN();
-			updateHC(before, SP);
-			updateCarry(SP);
-			PC += 2;
-			break;
-		}
-		case 0xE9: // jp (hl)
-		{
-			PC = HL();
-			break;
-		}
-		case 0xEA: // ld (**), a
-		{
-			wByte(getNextWord(), A);
-			PC += 3;
-			break;
-		}
-		case 0xEB: // ~!GB
-		{
-#ifdef DEBUG
-			std::cout << "Opcode not supported by Gameboy: " << toHex((int16_t)opcode) << " at " << toHex(PC) << std::endl;
-			system("pause"); // this is for debugging only
-#endif // DEBUG
-			break;
-		}
-		case 0xEC: // ~!GB
-		{
-#ifdef DEBUG
-			std::cout << "Opcode not supported by Gameboy: " << toHex((int16_t)opcode) << " at " << toHex(PC) << std::endl;
-			system("pause"); // this is for debugging only
-#endif // DEBUG
-			break;
-		}
-		case 0xED: // EXTENDED INSTRUCTIONS ~!GB
-		{
-#ifdef DEBUG
-			std::cout << "Opcode not supported by Gameboy: " << toHex((int16_t)opcode) << " at " << toHex(PC) << std::endl;
-			system("pause"); // this is for debugging only
-#endif // DEBUG
-			break;
-		}
-		case 0xEE: // xor *
-		{
-			xorr(rByte(PC + 1));
-			PC++;
-			break;
-		}
-		case 0xEF: // rst 0x28
+
+		const uint64_t when = scheduler.next();
+		const int event = scheduler.pop();
+		switch (event)
 		{
-			rst(0x28);
-			break;
+			case evSerial: serialDone(); break;
+			case evTimer: timerOverflow(when); break;
+			case evLYC: lycMatch(when); break;
+			default: return event;
 		}
-		case 0xF0 : //ld a, (0xFF00 + n) or ldh, (*)
-		{
-			const ubyte low = static_cast<ubyte>(rByte(PC + 1)); // low byte
-			const addr16 addr = 0xFF00 + low; // high byte always 0xFF00
+	}
+}
 
-			A = rByte(addr);
-			if (low == 0x00) // joypad read
-			{
-				if (keyInfo.colID == b4)
+// @return whether the byte at addr can only change when an event fires or an interrupt handler runs
+static bool pollable(addr16 addr)
+{
+	switch (addr)
+	{
+		case JOYPAD: // only changes when the front end handles input, at vblank
+		case SC:
+		case IF:
+		case STAT:
+		case LY:
+		case LYC:
+		case IE:
+			return true;
+	}
+	return (addr >= WORK_RAM && addr <= RES_RAM_END) || (addr >= HIGH_RAM && addr <= HIGH_RAM_END);
+}
+
+const int maxIdleLoop = 16; // bytes
+
+// Polling loops like
+//		wait: ldh a, (LY)
+//			  cp 0x90
+//			  jr nz, wait
+// only read things that can't change before the next event and only set flags and A from them, so every pass until then goes the same way as this one
+// The passes that would finish before the event are skipped at once, the last one runs normally and sees whatever the event changed
+void CPU::skipIdleLoop(addr16 jump)
+{
+	if (jump - PC > maxIdleLoop || (pending != 0 && IME))
+	{
+		return;
+	}
+	// the taken jump, charged the way opJr charges it
+	const ubyte jumpOp = rByte(jump);
+	int cycles = clockTimes[jumpOp] + 4 - (jumpOp == 0x18 ? 5 : 0);
+	addr16 addr = PC;
+	while (addr < jump)
+	{
+		const ubyte op = rByte(addr);
+		int size = 1;
+		switch (op)
+		{
+			case 0xF0: // ldh a, (n)
+				if (!pollable(0xFF00 + rByte(addr + 1)))
+				{
+					return;
+				}
+				size = 2;
+				break;
+			case 0xFA: // ld a, (nn)
+				if (!pollable(rWord(addr + 1)))
+				{
+					return;
+				}
+				size = 3;
+				break;
+			case 0x7E: // ld a, (hl)
+				if (!pollable(static_cast<addr16>(HL())))
 				{
-					A = keyInfo.keys[p15] | keyInfo.colID | 0xC0; // set the upper (unused) bits with 0xC0
+					return;
 				}
-				else if (keyInfo.colID == b5)
+				break;
+			case 0xFE: // cp n
+			case 0xE6: // and n
+			case 0xF6: // or n
+				size = 2;
+				break;
+			case 0x00: // nop
+			case 0xA7: // and a
+			case 0xB7: // or a
+			case 0xBF: // cp a
+				break;
+			case 0xCB: // bit n, r
+			{
+				const ubyte cb = rByte(addr + 1);
+				if (cb < 0x40 || cb >= 0x80 || ((cb & 0x7) == 0x6 && !pollable(static_cast<addr16>(HL()))))
 				{
-					A = keyInfo.keys[p14] | keyInfo.colID | 0xC0;
+					return;
 				}
+				size = 2;
+				break;
 			}
-			PC += 2;
-			break;
+			default: // anything that writes memory, changes registers from pass to pass or branches
+				return;
 		}
-		case 0xF1: // pop af
-		{
-			AF(pop());
-			PC++;
-			break;
-		}
-		case 0xF2: // ld a, (C)
-		{
-			const addr16 addr = static_cast<ubyte>(C) + 0xFF00;
-			A = rByte(addr);
-			PC++;
-			break;
-		}
-		case 0xF3: // di
-		{
-			IME = false;
-			PC++;
-			break;
-		}
-		case 0xF4: // ~!GB
-		{
-#ifdef DEBUG
-			std::cout << "Opcode not supported by Gameboy: " << toHex((int16_t)opcode) << " at " << toHex(PC) << std::endl;
-			system("pause"); // this is for debugging only
-#endif // DEBUG
-			break;
-		}
-		case 0xF5: // push af
-		{
-			push(AF());
-			PC++;
-			break;
-		}
-		case 0xF6: // or *
-		{
-			orr(rByte(PC + 1));
-			PC++;
-			break;
-		}
-		case 0xF7: // rst 0x30
-		{
-			rst(0x30);
-			break;
-		}
-		case 0xF8: // ld hl, sp
-		{
-			HL(SP + rByte(PC + 1));
-			PC += 2;
-			break;
-		}
-		case 0xF9: // ld sp, hl
-		{
-			SP = HL();
-			PC++;
-			break;
-		}
-		case 0xFA: // ld a, (**)
-		{
-			A = rByte(getNextWord());
-			PC += 3;
-			break;
-		}
-		case 0xFB: // ei
-		{
-			IME = true;
-			PC++;
-			break;
-		}
-		case 0xFC: // ~!GB
-		{
+		cycles += clockTimes[op];
+		addr += size;
+	}
+	const uint64_t next = scheduler.next();
+	if (addr == jump && clockCycles < next && next != UINT64_MAX)
+	{
+		clockCycles += (next - clockCycles) / cycles * cycles;
+	}
+}
+
+void CPU::emulateCycle()
+{
+	if (pending != 0 && IME)
+	{
+		handleInterrupts();
+	}
+
+	ubyte opcode = rByte(PC); // get next opcode
+	clockCycles += clockTimes[opcode];
+	emulateInstruction(opcode);
+}
+
+void CPU::emulateInstruction(ubyte opcode)
+{
 #ifdef DEBUG
-			std::cout << "Opcode not supported by Gameboy: " << toHex((int16_t)opcode) << " at " << toHex(PC) << std::endl;
-			system("pause"); // this is for debugging only
+	if (_test)
+	{
+		std::cout << toHex(opcode) << "\tat " << toHex(PC) << "\n";
+	}
 #endif // DEBUG
-			break;
-		}
-		case 0xFD: // ~!GB
-		{
+	(this->*opTable[opcode])();
+}
+
+#pragma region OpHandlers
+
+// operand accessors, the switches fold away since the operand is a template parameter
+
+template<int r>
+inline byte CPU::getOp()
+{
+	switch (r)
+	{
+		case rB: return B;
+		case rC: return C;
+		case rD: return D;
+		case rE: return E;
+		case rH: return H;
+		case rL: return L;
+		case rHLmem: return rByte(static_cast<addr16>(HL()));
+		default: return A;
+	}
+}
+
+template<int r>
+inline void CPU::setOp(byte val)
+{
+	switch (r)
+	{
+		case rB: B = val; break;
+		case rC: C = val; break;
+		case rD: D = val; break;
+		case rE: E = val; break;
+		case rH: H = val; break;
+		case rL: L = val; break;
+		case rHLmem: wByte(static_cast<addr16>(HL()), val); break;
+		default: A = val; break;
+	}
+}
+
+template<int rp>
+inline reg16 CPU::getPair()
+{
+	switch (rp)
+	{
+		case rBC: return BC();
+		case rDE: return DE();
+		case rHL: return HL();
+		case rSP: return SP;
+		default: return AF();
+	}
+}
+
+template<int rp>
+inline void CPU::setPair(word val)
+{
+	switch (rp)
+	{
+		case rBC: BC(val); break;
+		case rDE: DE(val); break;
+		case rHL: HL(val); break;
+		case rSP: SP = val; break;
+		default: AF(val); break;
+	}
+}
+
+template<int cc>
+inline bool CPU::condition() const
+{
+	switch (cc)
+	{
+		case condNZ: return !zero();
+		case condZ: return zero();
+		case condNC: return !carry();
+		case condC: return carry();
+		default: return true;
+	}
+}
+
+// SP + a signed offset, as used by add sp, * and ld hl, sp + *
+// Flags come from the unsigned add of the low byte
+addr16 CPU::offsetSP(byte offset)
+{
+	const int lo = static_cast<ubyte>(offset);
+	setFlags((((SP & 0xF) + (lo & 0xF)) > 0xF ? flagH : 0) |
+		(((SP & 0xFF) + lo) > 0xFF ? flagC : 0));
+	return SP + offset;
+}
+
+void CPU::opNop()
+{
+	PC++;
+}
+
+void CPU::opUnsupported()
+{
 #ifdef DEBUG
-			std::cout << "Opcode not supported by Gameboy: " << toHex(opcode) << " at " << toHex(PC) << std::endl;
-			system("pause"); // this is for debugging only
+	std::cout << "Opcode not supported by Gameboy: " << toHex(static_cast<int16_t>(rByte(PC) & 0xFF)) << " at " << toHex(PC) << std::endl;
+	system("pause"); // this is for debugging only
 #endif // DEBUG
-			break;
-		}
-		case 0xFE: // cp *
+}
+
+// ld r8, r8 / ld r8, (hl) / ld (hl), r8
+template<int dst, int src>
+void CPU::opLd()
+{
+	setOp<dst>(getOp<src>());
+	PC++;
+}
+
+// ld r8, *
+template<int dst>
+void CPU::opLdImm()
+{
+	setOp<dst>(rByte(PC + 1));
+	PC += 2;
+}
+
+// add/adc/sub/sbc/and/xor/or/cp a, r8
+template<void (CPU::*alu)(byte), int src>
+void CPU::opAlu()
+{
+	(this->*alu)(getOp<src>());
+}
+
+// add/adc/sub/sbc/and/xor/or/cp a, *
+template<void (CPU::*alu)(byte)>
+void CPU::opAluImm()
+{
+	(this->*alu)(rByte(PC + 1));
+	PC++; // 2 byte opcode
+}
+
+template<int r>
+void CPU::opInc()
+{
+	byte val = getOp<r>();
+	inc(val);
+	setOp<r>(val);
+}
+
+template<int r>
+void CPU::opDec()
+{
+	byte val = getOp<r>();
+	dec(val);
+	setOp<r>(val);
+}
+
+// ld r16, **
+template<int rp>
+void CPU::opLd16Imm()
+{
+	setPair<rp>(getNextWord());
+	PC += 3;
+}
+
+template<int rp>
+void CPU::opInc16()
+{
+	setPair<rp>(getPair<rp>() + 1);
+	PC++;
+}
+
+template<int rp>
+void CPU::opDec16()
+{
+	setPair<rp>(getPair<rp>() - 1);
+	PC++;
+}
+
+// add hl, r16
+template<int rp>
+void CPU::opAddHL()
+{
+	const int hl = static_cast<uword>(HL());
+	const int val = static_cast<uword>(getPair<rp>());
+	HL(hl + val);
+	// zero is unaffected, half carry and carry come out of bits 11 and 15
+	setFlags((flags() & flagZ) |
+		(((hl & 0xFFF) + (val & 0xFFF)) > 0xFFF ? flagH : 0) |
+		((hl + val) > 0xFFFF ? flagC : 0));
+	PC++;
+}
+
+template<int rp>
+void CPU::opPush()
+{
+	push(getPair<rp>());
+	PC++;
+}
+
+template<int rp>
+void CPU::opPop()
+{
+	setPair<rp>(pop());
+	PC++;
+}
+
+// ld (r16), a
+template<int rp>
+void CPU::opStoreA()
+{
+	wByte(static_cast<addr16>(getPair<rp>()), A);
+	PC++;
+}
+
+// ld a, (r16)
+template<int rp>
+void CPU::opLoadA()
+{
+	A = rByte(static_cast<addr16>(getPair<rp>()));
+	PC++;
+}
+
+// ldi/ldd (hl), a
+template<int delta>
+void CPU::opStoreAHL()
+{
+	wByte(static_cast<addr16>(HL()), A);
+	HL(HL() + delta);
+	PC++;
+}
+
+// ldi/ldd a, (hl)
+template<int delta>
+void CPU::opLoadAHL()
+{
+	A = rByte(static_cast<addr16>(HL()));
+	HL(HL() + delta);
+	PC++;
+}
+
+template<int cc>
+void CPU::opJr()
+{
+	const addr16 from = PC;
+	const sbyte to = static_cast<sbyte>(rByte(PC + 1));
+	jr(condition<cc>(), to, 2);
+	if (cc == condAlways)
+	{
+		clockCycles -= 5;
+	}
+	if (to < 0 && PC != from + 2) // taken backwards, might be waiting on something
+	{
+		skipIdleLoop(from);
+	}
+}
+
+template<int cc>
+void CPU::opJp()
+{
+	jp(condition<cc>(), getNextWord(), 3);
+}
+
+template<int cc>
+void CPU::opCall()
+{
+	call(condition<cc>());
+}
+
+template<int cc>
+void CPU::opRet()
+{
+	ret(condition<cc>());
+}
+
+template<uint8_t vec>
+void CPU::opRst()
+{
+#ifdef DEBUG
+	if (vec == 0x38)
+	{
+		std::cout << "rst 0x38\n\n";
+		dumpCPU();
+		system("pause");
+	}
+#endif
+	rst(vec);
+}
+
+// rlca/rrca/rla/rra, same as the 0xCB rotates except zero is always reset
+template<int kind>
+void CPU::opRotateA()
+{
+	A = alu<kind>(A, 0, carry(), static_cast<ubyte>(~flagZ));
+	PC++;
+}
+
+// ld (**), sp
+void CPU::opLdNNSP()
+{
+	wWord(getNextWord(), SP);
+	PC += 3;
+}
+
+void CPU::opStop()
+{
+	stop();
+	PC++;
+}
+
+void CPU::opDaa()
+{
+	// the table is indexed by the N, H and C flags
+	const AluResult& res = AluTables::daa[(flags() >> 4) & 0x7][static_cast<ubyte>(A)];
+	A = res.result;
+	setFlags(res.flags);
+	PC++;
+}
+
+void CPU::opCpl()
+{
+	A = ~A;
+	setFlags(flags() | flagN | flagH);
+	PC++;
+}
+
+void CPU::opScf()
+{
+	setFlags((flags() & flagZ) | flagC);
+	PC++;
+}
+
+// ccf inverts carry
+void CPU::opCcf()
+{
+	setFlags((flags() & (flagZ | flagC)) ^ flagC);
+	PC++;
+}
+
+void CPU::opHalt()
+{
+	halt();
+	PC++;
+}
+
+void CPU::opPrefixCB()
+{
+	emulateBitInstruction(rByte(PC + 1));
+}
+
+void CPU::opReti()
+{
+	ret(true);
+	clockCycles -= 4;
+	IME = true;
+}
+
+// ld (0xFF00 + n), a
+void CPU::opLdhStore()
+{
+	const ubyte low = static_cast<ubyte>(rByte(PC + 1)) & 0xFF;
+	const addr16 addr = 0xFF00 + low;
+	wByte(addr, A);
+	PC += 2;
+}
+
+// ld a, (0xFF00 + n) or ldh, (*)
+void CPU::opLdhLoad()
+{
+	const ubyte low = static_cast<ubyte>(rByte(PC + 1)); // low byte
+	const addr16 addr = 0xFF00 + low; // high byte always 0xFF00
+
+	A = rByte(addr);
+	if (low == 0x00) // joypad read
+	{
+		if (keyInfo.colID == b4)
 		{
-			cmp(rByte(PC + 1));
-			PC++;
-			break;
+			A = keyInfo.keys[p15] | keyInfo.colID | 0xC0; // set the upper (unused) bits with 0xC0
 		}
-		case 0xFF: // rst 0x38
+		else if (keyInfo.colID == b5)
 		{
-#ifdef DEBUG
-			std::cout << "rst 0x38\n\n";
-			dumpCPU();
-			system("pause");
-#endif
-			rst(0x38);
-			break;
+			A = keyInfo.keys[p14] | keyInfo.colID | 0xC0;
 		}
 	}
+	PC += 2;
+}
+
+// ld (C), a
+void CPU::opStoreAC()
+{
+	const addr16 addr = static_cast<ubyte>(C) + 0xFF00;
+	wByte(addr, A);
+	PC++;
+}
+
+// ld a, (C)
+void CPU::opLoadAC()
+{
+	const addr16 addr = static_cast<ubyte>(C) + 0xFF00;
+	A = rByte(addr);
+	PC++;
+}
+
+// add sp, *
+void CPU::opAddSP()
+{
+	SP = offsetSP(rByte(PC + 1));
+	PC += 2;
+}
+
+// jp (hl)
+void CPU::opJpHL()
+{
+	PC = HL();
+}
+
+// ld (**), a
+void CPU::opStoreANN()
+{
+	wByte(getNextWord(), A);
+	PC += 3;
+}
+
+// ld a, (**)
+void CPU::opLoadANN()
+{
+	A = rByte(getNextWord());
+	PC += 3;
+}
+
+// ld hl, sp + *
+void CPU::opLdHLSP()
+{
+	HL(offsetSP(rByte(PC + 1)));
+	PC += 2;
+}
+
+// ld sp, hl
+void CPU::opLdSPHL()
+{
+	SP = HL();
+	PC++;
+}
+
+void CPU::opDi()
+{
+	IME = false;
+	PC++;
+}
+
+void CPU::opEi()
+{
+	IME = true;
+	PC++;
+}
+
+#pragma endregion
+
+#pragma region OpTable
+
+// Every opcode is dispatched through this table,
+// operands are template parameters so each entry is a single straight-line handler
+const CPU::OpHandler CPU::opTable[256] =
+{
+	// 0x00
+	&CPU::opNop, &CPU::opLd16Imm<rBC>, &CPU::opStoreA<rBC>, &CPU::opInc16<rBC>, &CPU::opInc<rB>, &CPU::opDec<rB>, &CPU::opLdImm<rB>, &CPU::opRotateA<shiftRLC>,
+	&CPU::opLdNNSP, &CPU::opAddHL<rBC>, &CPU::opLoadA<rBC>, &CPU::opDec16<rBC>, &CPU::opInc<rC>, &CPU::opDec<rC>, &CPU::opLdImm<rC>, &CPU::opRotateA<shiftRRC>,
+	// 0x10
+	&CPU::opStop, &CPU::opLd16Imm<rDE>, &CPU::opStoreA<rDE>, &CPU::opInc16<rDE>, &CPU::opInc<rD>, &CPU::opDec<rD>, &CPU::opLdImm<rD>, &CPU::opRotateA<shiftRL>,
+	&CPU::opJr<condAlways>, &CPU::opAddHL<rDE>, &CPU::opLoadA<rDE>, &CPU::opDec16<rDE>, &CPU::opInc<rE>, &CPU::opDec<rE>, &CPU::opLdImm<rE>, &CPU::opRotateA<shiftRR>,
+	// 0x20
+	&CPU::opJr<condNZ>, &CPU::opLd16Imm<rHL>, &CPU::opStoreAHL<1>, &CPU::opInc16<rHL>, &CPU::opInc<rH>, &CPU::opDec<rH>, &CPU::opLdImm<rH>, &CPU::opDaa,
+	&CPU::opJr<condZ>, &CPU::opAddHL<rHL>, &CPU::opLoadAHL<1>, &CPU::opDec16<rHL>, &CPU::opInc<rL>, &CPU::opDec<rL>, &CPU::opLdImm<rL>, &CPU::opCpl,
+	// 0x30
+	&CPU::opJr<condNC>, &CPU::opLd16Imm<rSP>, &CPU::opStoreAHL<-1>, &CPU::opInc16<rSP>, &CPU::opInc<rHLmem>, &CPU::opDec<rHLmem>, &CPU::opLdImm<rHLmem>, &CPU::opScf,
+	&CPU::opJr<condC>, &CPU::opAddHL<rSP>, &CPU::opLoadAHL<-1>, &CPU::opDec16<rSP>, &CPU::opInc<rA>, &CPU::opDec<rA>, &CPU::opLdImm<rA>, &CPU::opCcf,
+	// 0x40
+	&CPU::opLd<rB, rB>, &CPU::opLd<rB, rC>, &CPU::opLd<rB, rD>, &CPU::opLd<rB, rE>, &CPU::opLd<rB, rH>, &CPU::opLd<rB, rL>, &CPU::opLd<rB, rHLmem>, &CPU::opLd<rB, rA>,
+	&CPU::opLd<rC, rB>, &CPU::opLd<rC, rC>, &CPU::opLd<rC, rD>, &CPU::opLd<rC, rE>, &CPU::opLd<rC, rH>, &CPU::opLd<rC, rL>, &CPU::opLd<rC, rHLmem>, &CPU::opLd<rC, rA>,
+	// 0x50
+	&CPU::opLd<rD, rB>, &CPU::opLd<rD, rC>, &CPU::opLd<rD, rD>, &CPU::opLd<rD, rE>, &CPU::opLd<rD, rH>, &CPU::opLd<rD, rL>, &CPU::opLd<rD, rHLmem>, &CPU::opLd<rD, rA>,
+	&CPU::opLd<rE, rB>, &CPU::opLd<rE, rC>, &CPU::opLd<rE, rD>, &CPU::opLd<rE, rE>, &CPU::opLd<rE, rH>, &CPU::opLd<rE, rL>, &CPU::opLd<rE, rHLmem>, &CPU::opLd<rE, rA>,
+	// 0x60
+	&CPU::opLd<rH, rB>, &CPU::opLd<rH, rC>, &CPU::opLd<rH, rD>, &CPU::opLd<rH, rE>, &CPU::opLd<rH, rH>, &CPU::opLd<rH, rL>, &CPU::opLd<rH, rHLmem>, &CPU::opLd<rH, rA>,
+	&CPU::opLd<rL, rB>, &CPU::opLd<rL, rC>, &CPU::opLd<rL, rD>, &CPU::opLd<rL, rE>, &CPU::opLd<rL, rH>, &CPU::opLd<rL, rL>, &CPU::opLd<rL, rHLmem>, &CPU::opLd<rL, rA>,
+	// 0x70
+	&CPU::opLd<rHLmem, rB>, &CPU::opLd<rHLmem, rC>, &CPU::opLd<rHLmem, rD>, &CPU::opLd<rHLmem, rE>, &CPU::opLd<rHLmem, rH>, &CPU::opLd<rHLmem, rL>, &CPU::opHalt, &CPU::opLd<rHLmem, rA>,
+	&CPU::opLd<rA, rB>, &CPU::opLd<rA, rC>, &CPU::opLd<rA, rD>, &CPU::opLd<rA, rE>, &CPU::opLd<rA, rH>, &CPU::opLd<rA, rL>, &CPU::opLd<rA, rHLmem>, &CPU::opLd<rA, rA>,
+	// 0x80
+	&CPU::opAlu<&CPU::add, rB>, &CPU::opAlu<&CPU::add, rC>, &CPU::opAlu<&CPU::add, rD>, &CPU::opAlu<&CPU::add, rE>, &CPU::opAlu<&CPU::add, rH>, &CPU::opAlu<&CPU::add, rL>, &CPU::opAlu<&CPU::add, rHLmem>, &CPU::opAlu<&CPU::add, rA>,
+	&CPU::opAlu<&CPU::adc, rB>, &CPU::opAlu<&CPU::adc, rC>, &CPU::opAlu<&CPU::adc, rD>, &CPU::opAlu<&CPU::adc, rE>, &CPU::opAlu<&CPU::adc, rH>, &CPU::opAlu<&CPU::adc, rL>, &CPU::opAlu<&CPU::adc, rHLmem>, &CPU::opAlu<&CPU::adc, rA>,
+	// 0x90
+	&CPU::opAlu<&CPU::sub, rB>, &CPU::opAlu<&CPU::sub, rC>, &CPU::opAlu<&CPU::sub, rD>, &CPU::opAlu<&CPU::sub, rE>, &CPU::opAlu<&CPU::sub, rH>, &CPU::opAlu<&CPU::sub, rL>, &CPU::opAlu<&CPU::sub, rHLmem>, &CPU::opAlu<&CPU::sub, rA>,
+	&CPU::opAlu<&CPU::sbc, rB>, &CPU::opAlu<&CPU::sbc, rC>, &CPU::opAlu<&CPU::sbc, rD>, &CPU::opAlu<&CPU::sbc, rE>, &CPU::opAlu<&CPU::sbc, rH>, &CPU::opAlu<&CPU::sbc, rL>, &CPU::opAlu<&CPU::sbc, rHLmem>, &CPU::opAlu<&CPU::sbc, rA>,
+	// 0xA0
+	&CPU::opAlu<&CPU::andr, rB>, &CPU::opAlu<&CPU::andr, rC>, &CPU::opAlu<&CPU::andr, rD>, &CPU::opAlu<&CPU::andr, rE>, &CPU::opAlu<&CPU::andr, rH>, &CPU::opAlu<&CPU::andr, rL>, &CPU::opAlu<&CPU::andr, rHLmem>, &CPU::opAlu<&CPU::andr, rA>,
+	&CPU::opAlu<&CPU::xorr, rB>, &CPU::opAlu<&CPU::xorr, rC>, &CPU::opAlu<&CPU::xorr, rD>, &CPU::opAlu<&CPU::xorr, rE>, &CPU::opAlu<&CPU::xorr, rH>, &CPU::opAlu<&CPU::xorr, rL>, &CPU::opAlu<&CPU::xorr, rHLmem>, &CPU::opAlu<&CPU::xorr, rA>,
+	// 0xB0
+	&CPU::opAlu<&CPU::orr, rB>, &CPU::opAlu<&CPU::orr, rC>, &CPU::opAlu<&CPU::orr, rD>, &CPU::opAlu<&CPU::orr, rE>, &CPU::opAlu<&CPU::orr, rH>, &CPU::opAlu<&CPU::orr, rL>, &CPU::opAlu<&CPU::orr, rHLmem>, &CPU::opAlu<&CPU::orr, rA>,
+	&CPU::opAlu<&CPU::cmp, rB>, &CPU::opAlu<&CPU::cmp, rC>, &CPU::opAlu<&CPU::cmp, rD>, &CPU::opAlu<&CPU::cmp, rE>, &CPU::opAlu<&CPU::cmp, rH>, &CPU::opAlu<&CPU::cmp, rL>, &CPU::opAlu<&CPU::cmp, rHLmem>, &CPU::opAlu<&CPU::cmp, rA>,
+	// 0xC0
+	&CPU::opRet<condNZ>, &CPU::opPop<rBC>, &CPU::opJp<condNZ>, &CPU::opJp<condAlways>, &CPU::opCall<condNZ>, &CPU::opPush<rBC>, &CPU::opAluImm<&CPU::add>, &CPU::opRst<0x00>,
+	&CPU::opRet<condZ>, &CPU::opRet<condAlways>, &CPU::opJp<condZ>, &CPU::opPrefixCB, &CPU::opCall<condZ>, &CPU::opCall<condAlways>, &CPU::opAluImm<&CPU::adc>, &CPU::opRst<0x08>,
+	// 0xD0
+	&CPU::opRet<condNC>, &CPU::opPop<rDE>, &CPU::opJp<condNC>, &CPU::opNop, &CPU::opCall<condNC>, &CPU::opPush<rDE>, &CPU::opAluImm<&CPU::sub>, &CPU::opRst<0x10>,
+	&CPU::opRet<condC>, &CPU::opReti, &CPU::opJp<condC>, &CPU::opUnsupported, &CPU::opCall<condC>, &CPU::opUnsupported, &CPU::opAluImm<&CPU::sbc>, &CPU::opRst<0x18>,
+	// 0xE0
+	&CPU::opLdhStore, &CPU::opPop<rHL>, &CPU::opStoreAC, &CPU::opUnsupported, &CPU::opUnsupported, &CPU::opPush<rHL>, &CPU::opAluImm<&CPU::andr>, &CPU::opRst<0x20>,
+	&CPU::opAddSP, &CPU::opJpHL, &CPU::opStoreANN, &CPU::opUnsupported, &CPU::opUnsupported, &CPU::opUnsupported, &CPU::opAluImm<&CPU::xorr>, &CPU::opRst<0x28>,
+	// 0xF0
+	&CPU::opLdhLoad, &CPU::opPop<rAF>, &CPU::opLoadAC, &CPU::opDi, &CPU::opUnsupported, &CPU::opPush<rAF>, &CPU::opAluImm<&CPU::orr>, &CPU::opRst<0x30>,
+	&CPU::opLdHLSP, &CPU::opLdSPHL, &CPU::opLoadANN, &CPU::opEi, &CPU::opUnsupported, &CPU::opUnsupported, &CPU::opAluImm<&CPU::cmp>, &CPU::opRst<0x38>,
+};
+
+#pragma endregion
+
+#pragma region CBTable
+
+// rlc/rrc/rl/rr/sla/sra/swap/srl r8
+template<int kind, int r>
+void CPU::opShift()
+{
+	setOp<r>(alu<kind>(getOp<r>(), 0, carry()));
+	PC += 2; // all 0xCB instructions are 2 bytes long
+}
+
+// bit n, r8 (never writes back, so bit n, (hl) is a single read)
+template<int n, int r>
+void CPU::opBit()
+{
+	bit(getOp<r>(), 1 << n);
+	PC += 2;
+}
+
+template<int n, int r>
+void CPU::opRes()
+{
+	reg val = getOp<r>();
+	res(val, 1 << n);
+	setOp<r>(val);
+	PC += 2;
+}
+
+template<int n, int r>
+void CPU::opSet()
+{
+	reg val = getOp<r>();
+	set(val, 1 << n);
+	setOp<r>(val);
+	PC += 2;
+}
+
+// the 0xCB opcodes are fully regular: bits 0-2 select the operand,
+// bits 3-5 the shift kind or bit number and bits 6-7 the operation
+template<int opcode>
+constexpr CPU::OpHandler CPU::cbHandler()
+{
+	return opcode >= 0xC0 ? &CPU::opSet<(opcode >> 3) & 0x7, opcode & 0x7> :
+		   opcode >= 0x80 ? &CPU::opRes<(opcode >> 3) & 0x7, opcode & 0x7> :
+		   opcode >= 0x40 ? &CPU::opBit<(opcode >> 3) & 0x7, opcode & 0x7> :
+							&CPU::opShift<(opcode >> 3) & 0x7, opcode & 0x7>;
+}
+
+template<int... I>
+struct CPU::CBTable<Indices<I...>>
+{
+	static constexpr OpHandler handlers[sizeof...(I)] = { cbHandler<I>()... };
+};
+
+template<int... I>
+constexpr CPU::OpHandler CPU::CBTable<Indices<I...>>::handlers[sizeof...(I)];
+
+void CPU::emulateBitInstruction(ubyte opcode)
+{
+	(this->*CBTable<MakeIndices<256>::type>::handlers[opcode])();
 }
 
+#pragma endregion
+
 int CPU::loadROM(const std::string& fileName)
 {
-	std::ifstream file(fileName, std::ios::in | std::ios::binary | std::ios::ate);
-	char* ROMstr;
-	std::streampos size;
-	if (file.is_open())
-	{
-		size = file.tellg();
-		ROMstr = new char[size]; // get rom size
-		std::cout << "Seek size: " << size << std::endl;
-		file.seekg(0, std::ios::beg);
-		file.read(ROMstr, size); // load the rom file into the file
-		file.close();
-	}
-	else
+	std::shared_ptr<const ROMFile> rom = ROMCache::load(fileName);
+	if (rom == nullptr)
 	{
 		return 1; // file load fail
 	}
+	std::cout << "ROM size: " << rom->size() << std::endl;
 
-	if (ROMstr == nullptr)
-	{
-		delete[] ROMstr;
-		return 3; // mem alloc failure
-	}
-	
-	cart.init(ROMstr, size);
+	// battery backed RAM is saved next to the ROM
+	const size_t ext = fileName.find_last_of('.');
+	const size_t dir = fileName.find_last_of("/\\");
+	const bool hasExt = ext != std::string::npos && (dir == std::string::npos || ext > dir);
+	const std::string saveFileName = (hasExt ? fileName.substr(0, ext) : fileName) + ".sav";
 
-	delete[] ROMstr;
+	cart.init(rom, saveFileName, &memMap);
 	return EXIT_SUCCESS; // ROM load completed succesfully
-}
\ No newline at end of file
+}
@@ -3,15 +3,25 @@
 
 #define DEBUG
 
+// Evaluate Z/N/H/C only when something reads them instead of after every ALU operation
+// The operands of the last ALU operation are kept instead
+//#define LAZY_FLAGS
+
 #include <iostream>
 #include <fstream>
 #include <sstream>
 #include <vector>
+#include <algorithm>
+#include <cstring>
 
 #include "memdefs.h"
 #include "input.h"
 #include "types.h"
 #include "cart.h"
+#include "memmap.h"
+#include "scheduler.h"
+#include "indices.h"
+#include "alu.h"
 
 #ifdef DEBUG
 #include "toHex.h"
@@ -31,11 +41,26 @@ Resources:
 * And many more
 **/
 
+// Declares the 16 bit register pair <pair> with its upper and lower bytes aliased as <hi> and <lo>
+#ifdef GB_BIG_ENDIAN
+#define REGISTER_PAIR(pair, hiType, hi, loType, lo) union { uword pair; struct { hiType hi; loType lo; }; }
+#else
+#define REGISTER_PAIR(pair, hiType, hi, loType, lo) union { uword pair; struct { loType lo; hiType hi; }; }
+#endif
+
 #define MAX_ROM_SIZE 0xBFFF
 #define MEM_SIZE 0xFFFF + 0x1 // addresses up to and including 0xFFFF
 
-#define ADD true
-#define SUB false
+// Told about writes to video RAM and OAM, so anything derived from them can be kept up to date
+class VRAMListener
+{
+public:
+	virtual ~VRAMListener() {}
+	// @param addr is in CHARACTER_RAM-BG_MAP_1_END, only called when the value changed
+	virtual void vramWritten(addr16 addr) = 0;
+	// OAM changed, by a store or a DMA
+	virtual void oamWritten() = 0;
+};
 
 class CPU
 {
@@ -43,7 +68,10 @@ public:
 	CPU();
 	~CPU();
 
-	void emulateCycle();
+	// Runs instructions until the next scheduled event is due and handles the events that belong to the CPU (serial)
+	// @return the first due event that belongs to someone else (one of Events)
+	int run();
+	void emulateCycle(); // a single instruction, without looking at the scheduler
 	int loadROM(const std::string& fileName);
 	void test();
 
@@ -51,13 +79,35 @@ public:
 	void dumpCPU();
 #endif // DEBUG
 
-	std::vector<byte>* dumpMem() { return &internalmem; }
+	// Read only views of the memory the PPU draws from
+	const byte* videoRAM() const { return internalmem.videoRAM; } // starts at CHARACTER_RAM
+	const byte* oam() const { return internalmem.oam; } // starts at OAM
+	// Writes to video RAM and OAM go through the listener from now on
+	void setVRAMListener(VRAMListener* listener);
 
 // CPU status getting/ setting functions
 public:
-	void wByte(addr16 addr, byte val);
-	byte rByte(addr16 addr) const; // read byte
-	byte* gByte(addr16 addr);
+	inline void wByte(addr16 addr, byte val)
+	{
+		byte* page = memMap.write[addr >> 8];
+		if (page != nullptr)
+		{
+			page[addr & 0xFF] = val;
+		}
+		else
+		{
+			wByteUnmapped(addr, val);
+		}
+	}
+	inline byte rByte(addr16 addr) const // read byte
+	{
+		if (addr >= HIGH_RAM)
+		{
+			return ioReg(addr); // HRAM and IE share the unmapped I/O page but are plain memory, stack pops and ldh variables stay a single load
+		}
+		const byte* page = memMap.read[addr >> 8];
+		return page != nullptr ? page[addr & 0xFF] : rByteUnmapped(addr);
+	}
 	inline void clrBit(byte& val, byte bit) { val &= ~bit; }
 
 	void wWord(addr16 addr, word val);
@@ -68,8 +118,18 @@ public:
 	void unHalt() { halted = false; }
 	void unStop() { stopped = false; }
 
-	void resetClock() { clockCycles = 0; }
-	uint16_t getClockCycles() const { return clockCycles; }
+	void flushSaveRAM() { cart.flushRAM(); } // at frame boundaries
+
+	uint64_t getClockCycles() const { return clockCycles; }
+	Scheduler& events() { return scheduler; }
+
+	// Sets bits of IF
+	void requestInterrupt(ubyte bits) { ioReg(IF) |= bits; updatePending(); }
+
+	// LY counts from line 0 starting now
+	void startLCD();
+	// Sets the mode bits of STAT, writes from the CPU leave them alone
+	void setLCDMode(int mode) { ioReg(STAT) = (ioReg(STAT) & ~0x3) | mode; }
 
 	GBKeys keyInfo;
 
@@ -82,65 +142,144 @@ private:
 
 // registers
 private:
-	// 8 bit registers
-	reg A;
-	reg B;
-	reg C;
-	reg D;
-	reg E;
-	reg H;
-	reg L;
-
-	unsigned char F;		// flag register
-	
-	// decode flag register bits
-	inline const bool zero()		const { return F & 0x40; }
-	inline const bool half_carry()	const { return F & 0x10; }
-	inline const bool N()			const { return F & 0x2; } // add or subtract
-	inline const bool carry()		const { return F & 0x1; }
-
-	// 16 bit "registers"
-	inline reg16 AF() { return ((A << 8) | (F & 0xFF)); }
-	inline reg16 BC() { return ((B << 8) | (C & 0xFF)); }
-	inline reg16 DE() { return ((D << 8) | (E & 0xFF)); }
-	inline reg16 HL() { return ((H << 8) | (L & 0xFF)); }
-
-	inline void AF(word val) { A = ((val >> 0x8) & 0xFF); F = val & 0xFF; } // For Hb: shift the value up and mask off lower bits
-	inline void BC(word val) { B = ((val >> 0x8) & 0xFF); C = val & 0xFF; } // For Lb: mask upper bits
-	inline void DE(word val) { D = ((val >> 0x8) & 0xFF); E = val & 0xFF; }
-	inline void HL(word val) { H = ((val >> 0x8) & 0xFF); L = val & 0xFF; }
-
-	addr16 PC;		// program counter register
-	addr16 SP;		// stack pointer
+	// Everything the interpreter touches on every instruction, kept together in a single cache line
+	// The 8 bit registers alias the halves of the 16 bit pairs
+	struct alignas(64)
+	{
+		REGISTER_PAIR(af, reg, A, unsigned char, F); // F is the flag register, see Flags in alu.h
+		REGISTER_PAIR(bc, reg, B, reg, C);
+		REGISTER_PAIR(de, reg, D, reg, E);
+		REGISTER_PAIR(hl, reg, H, reg, L);
+
+		addr16 PC;		// program counter register
+		addr16 SP;		// stack pointer
+
+		bool IME = true;	// interrupt master enable
+		ubyte pending = 0;	// IE & IF, the interrupts waiting for IME
+
+		bool halted = false;	// HALT(ed)?
+		bool stopped = false;	// STOP(ed)?
+
+		uint64_t clockCycles = 0; // master clock, cycles since power on
+
+#ifdef LAZY_FLAGS
+		// The last ALU operation, F is only brought up to date when the flags are read
+		struct
+		{
+			ubyte op; // ShiftKinds or AluOps
+			ubyte a;
+			ubyte b;
+			ubyte c; // carry in
+			ubyte mask; // flags the operation sets
+			ubyte keep; // flags kept from before the operation
+			bool pending;
+		} lazyFlags;
+#endif
+	};
 
-	std::vector<byte> internalmem;
+#ifdef LAZY_FLAGS
+	ubyte flags() const; // F with the last ALU operation's flags applied
+#else
+	inline ubyte flags() const { return F; }
+#endif
+	inline void setFlags(ubyte f)
+	{
+		F = f;
+#ifdef LAZY_FLAGS
+		lazyFlags.pending = false;
+#endif
+	}
 
-	bool IME = true;	// interrupt master enable
+	// Performs an 8 bit ALU operation and sets the flags (or defers them with LAZY_FLAGS)
+	// @param op is one of ShiftKinds or AluOps
+	// @param mask is the flags the operation sets
+	// @param keep is the flags to keep from before the operation
+	// @return the result
+	template<int op>
+	inline ubyte alu(ubyte a, ubyte b, int c, ubyte mask = 0xFF, ubyte keep = 0);
 
-	bool halted = false;	// HALT(ed)?
-	bool stopped = false;	// STOP(ed)?
+	// decode flag register bits
+	inline const bool zero()		const { return (flags() & flagZ) != 0; }
+	inline const bool half_carry()	const { return (flags() & flagH) != 0; }
+	inline const bool N()			const { return (flags() & flagN) != 0; } // add or subtract
+	inline const bool carry()		const { return (flags() & flagC) != 0; }
 
-	uint16_t clockCycles = 0;
+	// 16 bit "registers"
+#ifdef LAZY_FLAGS
+	inline reg16 AF() { return ((A << 8) | flags()); }
+#else
+	inline reg16 AF() { return af; }
+#endif
+	inline reg16 BC() { return bc; }
+	inline reg16 DE() { return de; }
+	inline reg16 HL() { return hl; }
+
+	inline void AF(word val) { af = val & 0xFFF0; setFlags(F); } // the low 4 bits of F are always 0
+	inline void BC(word val) { bc = val; }
+	inline void DE(word val) { de = val; }
+	inline void HL(word val) { hl = val; }
+
+	// Storage for the parts of the address space that are backed by the gameboy's own memory
+	// Echo RAM is an alias of workRAM in the memory map, it doesn't need storage of its own, cart RAM belongs to the cart
+	struct
+	{
+		byte videoRAM[0x2000];	// 0x8000-0x9FFF
+		byte workRAM[0x2000];	// 0xC000-0xDFFF, also seen at 0xE000-0xFDFF
+		byte oam[PAGE_SIZE];	// 0xFE00-0xFEFF, only up to OAM_END is used
+		byte io[PAGE_SIZE];		// 0xFF00-0xFFFF, I/O registers, HRAM and IE
+	} internalmem;
+
+	inline byte& ioReg(addr16 addr) { return internalmem.io[addr & 0xFF]; }
+	inline byte ioReg(addr16 addr) const { return internalmem.io[addr & 0xFF]; }
 
 	Cart cart;
 
-// Flag helper functions
-private:
-	inline void updateZero(reg16 reg);
-	inline void resetZero();
-	inline void setZero();
-	
-	inline void updateHC(byte prevVal, byte newVal);
-	inline void resetHC();
-	inline void setHC();
-	
-	inline void updateN(bool add);
-	inline void resetN();
-	inline void setN();
-	
-	void updateCarry(uint16_t newVal);
-	inline void resetCarry();
-	inline void setCarry();
+	MemoryMap memMap; // ROM and cart RAM pages are mapped by the cart
+	void mapMemory();
+	byte rByteUnmapped(addr16 addr) const;
+	void wByteUnmapped(addr16 addr, byte val);
+
+	VRAMListener* vramListener = nullptr;
+	void wVRAM(addr16 addr, byte val);
+	void wOAM(addr16 addr, byte val);
+
+	// Write handlers for the I/O registers (0xFF00-0xFF7F) and IE, each subsystem registers its own in mapIO
+	typedef void (CPU::*IOHandler)(addr16 addr, byte val);
+	IOHandler ioHandlers[0x80 + 1];
+	static inline int ioIndex(addr16 addr) { return addr == IE ? 0x80 : addr & 0x7F; }
+	void mapIO();
+	void wIO(addr16 addr, byte val);
+
+	void ioStore(addr16 addr, byte val); // registers without side effects
+	void ioJoypad(addr16 addr, byte val);
+	void ioDIV(addr16 addr, byte val);
+	void ioDMA(addr16 addr, byte val);
+	void ioSerial(addr16 addr, byte val);
+	void ioTimer(addr16 addr, byte val);
+	void ioLCDStat(addr16 addr, byte val);
+	void ioInterrupt(addr16 addr, byte val); // IF and IE
+
+	inline void updatePending() { pending = ioReg(IE) & ioReg(IF) & 0x1F; }
+
+	// Reads of the I/O page, the counters are worked out from the clock
+	byte rIO(addr16 addr) const;
+
+	Scheduler scheduler;
+	void serialDone();
+
+	// DIV, TIMA and LY are never counted, they are worked out from how long it has been since these times when they are read
+	// and the interrupts they raise are scheduled for when they will happen
+	uint64_t divBase = 0; // when the divider was last 0
+	uint64_t timaBase = 0; // when TIMA last had the value stored in ioReg(TIMA)
+	uint64_t lcdBase = 0; // when line 0 started
+	int timerPeriod() const; // cycles per TIMA increment, 0 while the timer is stopped
+	ubyte timer() const; // TIMA
+	ubyte line() const { return static_cast<ubyte>((clockCycles - lcdBase) / LINE_CYCLES % NUM_LINES); } // LY
+	void foldTimer(); // stores TIMA as it is now, before the timer's settings change
+	void scheduleTimer();
+	void timerOverflow(uint64_t when);
+	void scheduleLYC();
+	void lycMatch(uint64_t when);
 
 // opcode functions
 private:
@@ -161,17 +300,10 @@ private:
 	void xorr(byte val);
 	void orr(byte val);
 	// extended instructions
-	void rlc(reg& val);
-	void rrc(reg& val);
-	void rl(reg& val);
-	void rr(reg& val);
-	void sla(reg& val);
-	void sra(reg& val);
-	void srl(reg& val);
 	void bit(reg r, ubyte bit);
 	void res(reg& r, ubyte bit);
 	void set(reg& r, ubyte bit);
-	inline void swap(reg& r);
+	addr16 offsetSP(byte offset);
 
 	template<bool memread = false>
 	inline void ld8(reg& dst, reg src);
@@ -179,11 +311,82 @@ private:
 	template<bool memread = false>
 	inline void ld16(reg& hi, reg& lo, reg16 src);
 
-	void updateInterrupts();
-	void updateTimer();
 	void emulateBitInstruction(ubyte opcode);
 	void emulateInstruction(ubyte opcode);
 
+// opcode dispatch
+private:
+	// 8 bit operands in the order the opcodes encode them, rHLmem is (HL)
+	enum Operand8 { rB = 0, rC, rD, rE, rH, rL, rHLmem, rA };
+	// 16 bit operands
+	enum Operand16 { rBC = 0, rDE, rHL, rSP, rAF };
+	// jump/ call/ ret conditions
+	enum Condition { condAlways = 0, condNZ, condZ, condNC, condC };
+
+	typedef void (CPU::*OpHandler)();
+	static const OpHandler opTable[256]; // one handler per opcode
+
+	template<int r> inline byte getOp();
+	template<int r> inline void setOp(byte val);
+	template<int rp> inline reg16 getPair();
+	template<int rp> inline void setPair(word val);
+	template<int cc> inline bool condition() const;
+
+	template<int dst, int src> void opLd();
+	template<int dst> void opLdImm();
+	template<void (CPU::*alu)(byte), int src> void opAlu();
+	template<void (CPU::*alu)(byte)> void opAluImm();
+	template<int r> void opInc();
+	template<int r> void opDec();
+	template<int rp> void opLd16Imm();
+	template<int rp> void opInc16();
+	template<int rp> void opDec16();
+	template<int rp> void opAddHL();
+	template<int rp> void opPush();
+	template<int rp> void opPop();
+	template<int rp> void opStoreA();
+	template<int rp> void opLoadA();
+	template<int delta> void opStoreAHL();
+	template<int delta> void opLoadAHL();
+	template<int cc> void opJr();
+	template<int cc> void opJp();
+	template<int cc> void opCall();
+	template<int cc> void opRet();
+	template<uint8_t vec> void opRst();
+	template<int kind> void opRotateA();
+
+	// 0xCB prefixed opcodes
+	template<int kind, int r> void opShift();
+	template<int n, int r> void opBit();
+	template<int n, int r> void opRes();
+	template<int n, int r> void opSet();
+	template<int opcode> static constexpr OpHandler cbHandler();
+	template<typename indices> struct CBTable; // handlers for all 256 0xCB opcodes
+
+	void opNop();
+	void opUnsupported();
+	void opLdNNSP();
+	void opStop();
+	void opDaa();
+	void opCpl();
+	void opScf();
+	void opCcf();
+	void opHalt();
+	void opPrefixCB();
+	void opReti();
+	void opLdhStore();
+	void opLdhLoad();
+	void opStoreAC();
+	void opLoadAC();
+	void opAddSP();
+	void opJpHL();
+	void opStoreANN();
+	void opLoadANN();
+	void opLdHLSP();
+	void opLdSPHL();
+	void opDi();
+	void opEi();
+
 	void push(reg16 val);
 	reg16 pop();
 
@@ -191,8 +394,10 @@ private:
 
 	void halt();
 	void stop();
+	// @param jump is the address of a jr just taken backwards
+	void skipIdleLoop(addr16 jump);
 
-	void dma();
+	void dma(ubyte src);
 	void interrupt(const byte loc);
 	void handleInterrupts();
 };
@@ -0,0 +1,19 @@
+#ifndef GB_INDICES_H
+#define GB_INDICES_H
+
+// Compile time index sequences, used to generate the opcode and ALU lookup tables
+// Indices<0, 1, ..., N - 1> is MakeIndices<N>::type
+
+template<int... I>
+struct Indices {};
+
+template<int N, int... I>
+struct MakeIndices : MakeIndices<N - 1, N - 1, I...> {};
+
+template<int... I>
+struct MakeIndices<0, I...>
+{
+	typedef Indices<I...> type;
+};
+
+#endif // GB_INDICES_H
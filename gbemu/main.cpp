@@ -1,4 +1,5 @@
 #include <iostream>
+#include <chrono>
 #include <SDL2/SDL.h>
 
 #undef main // fixes incompatibilities with some of MSVC2015's C function signitures with what SDL expects
@@ -9,6 +10,8 @@
 #ifdef DEBUG
 
 //#define DEBUG_CPU
+//#define BENCH_CPU // run the ROM headless and report the instruction throughput (compare with LAZY_FLAGS in cpu.h)
+//#define TEST_SAVES // load a battery backed ROM into two carts and check their RAM stays separate
 #define DEBUG_GFX
 #else
 #ifndef RELEASE
@@ -23,12 +26,71 @@
 #define MALLOC_FAIL 4
 #define DEFAULT_ERROR -1
 
+#ifdef BENCH_CPU
+int benchCPU(const char* romName)
+{
+	CPU cpu;
+	if (cpu.loadROM(romName) != EXIT_SUCCESS)
+	{
+		std::cout << "ROM <" << romName << "> failed to load" << std::endl;
+		return ROM_LOAD_FAIL;
+	}
+	const long long numInstructions = 100000000;
+	const auto start = std::chrono::high_resolution_clock::now();
+	for (long long i = 0; i < numInstructions; i++)
+	{
+		cpu.emulateCycle();
+	}
+	const std::chrono::duration<double> elapsed = std::chrono::high_resolution_clock::now() - start;
+#ifdef LAZY_FLAGS
+	std::cout << "lazy flags: ";
+#else
+	std::cout << "eager flags: ";
+#endif
+	std::cout << numInstructions / elapsed.count() / 1000000.0 << " million instructions/s" << std::endl;
+	return 0;
+}
+#endif // BENCH_CPU
+
+#ifdef TEST_SAVES
+int testSaves(const char* romName)
+{
+	CPU first;
+	CPU second;
+	if (first.loadROM(romName) != EXIT_SUCCESS || second.loadROM(romName) != EXIT_SUCCESS)
+	{
+		std::cout << "ROM <" << romName << "> failed to load" << std::endl;
+		return ROM_LOAD_FAIL;
+	}
+	// enable the RAM and write something different through each cart, the low 4 bits so it works with MBC2 too
+	first.wByte(0x0000, 0x0A);
+	second.wByte(0x0000, 0x0A);
+	first.wByte(CART_RAM, 0x01);
+	second.wByte(CART_RAM, 0x02);
+	first.flushSaveRAM();
+	second.flushSaveRAM();
+	if ((first.rByte(CART_RAM) & 0x0F) != 0x01 || (second.rByte(CART_RAM) & 0x0F) != 0x02)
+	{
+		std::cout << "the carts share their RAM" << std::endl;
+		return DEFAULT_ERROR;
+	}
+	std::cout << "the carts' RAM is separate" << std::endl;
+	return 0;
+}
+#endif // TEST_SAVES
+
 int main(int argc, char **argv)
 {	
 #ifdef DEBUG_CPU
 	CPU cpu;
 	cpu.test();
 	std::cin.ignore();
+#endif
+#ifdef BENCH_CPU
+	return benchCPU(argc == 2 ? argv[1] : "tetris.gb");
+#endif
+#ifdef TEST_SAVES
+	return testSaves(argc == 2 ? argv[1] : "tetris.gb");
 #endif
 	Gameboy gb;
 	if (argc == 2)
@@ -0,0 +1,343 @@
+#include <cstring>
+
+#include "mbc.h"
+#include "cart.h"
+
+MBC::MBC(const byte* rom, int numROMBanks, CartRAM& ram, MemoryMap* memMap)
+	: rom(rom), numROMBanks(numROMBanks), ram(ram), memMap(memMap)
+{
+
+}
+
+bool CartRAM::flush()
+{
+	if (!tracked())
+	{
+		return false;
+	}
+	// write back each run of dirty pages with one call
+	bool flushed = false;
+	size_t page = 0;
+	while (page < dirty.size())
+	{
+		if (!dirty[page])
+		{
+			page++;
+			continue;
+		}
+		const size_t start = page;
+		while (page < dirty.size() && dirty[page])
+		{
+			dirty[page++] = false;
+		}
+		save->flush(start * PAGE_SIZE, (page - start) * PAGE_SIZE);
+		flushed = true;
+	}
+	return flushed;
+}
+
+void MBC::map()
+{
+	mapROM0(0);
+	mapROM(1);
+	// the RAM starts disabled, this also drops anything an earlier cart left mapped there
+	memMap->mapRead(CART_RAM, ramBankSize, nullptr);
+	memMap->mapWrite(CART_RAM, ramBankSize, nullptr);
+}
+
+// Banks past the end of the ROM wrap around like the unused upper bank lines would
+void MBC::mapROM0(int bank)
+{
+	const byte* base = rom + (bank % numROMBanks) * banksize;
+	if (base != rom0Base)
+	{
+		memMap->mapRead(0x0000, banksize, base);
+		rom0Base = base;
+	}
+}
+
+void MBC::mapROM(int bank)
+{
+	const byte* base = rom + (bank % numROMBanks) * banksize;
+	if (base != romNBase)
+	{
+		memMap->mapRead(ROM_BANK_N, banksize, base);
+		romNBase = base;
+	}
+}
+
+void MBC::mapRAM(int bank, bool writable)
+{
+	if (ram.empty())
+	{
+		unmapRAM();
+		return;
+	}
+	if (ramMapped && bank == ramBank && writable == ramWritable)
+	{
+		return; // already mapped
+	}
+	for (int offset = 0; offset < ramBankSize; offset += PAGE_SIZE)
+	{
+		const size_t ramOffset = (bank * ramBankSize + offset) % ram.size;
+		memMap->read[(CART_RAM + offset) >> 8] = &ram.data[ramOffset];
+		memMap->write[(CART_RAM + offset) >> 8] = writable && ram.writable(ramOffset) ? &ram.data[ramOffset] : nullptr;
+	}
+	ramMapped = true;
+	ramBank = bank;
+	ramWritable = writable;
+}
+
+void MBC::unmapRAM()
+{
+	if (!ramMapped)
+	{
+		return; // bank switches with the RAM disabled don't touch the page table
+	}
+	ramMapped = false;
+	ram.flush(); // disabling the RAM is the game saying it is done with it
+	memMap->mapRead(CART_RAM, ramBankSize, nullptr);
+	memMap->mapWrite(CART_RAM, ramBankSize, nullptr);
+}
+
+void MBC::writeRAM(addr16 addr, byte val, bool mapPage)
+{
+	if (!ramMapped || addr < CART_RAM || addr > CART_RAM_END)
+	{
+		return; // disabled
+	}
+	const size_t offset = (ramBank * ramBankSize + (addr - CART_RAM)) % ram.size;
+	ram.data[offset] = val;
+	ram.markDirty(offset);
+	if (mapPage && ramWritable)
+	{
+		memMap->write[addr >> 8] = &ram.data[offset & ~(PAGE_SIZE - 1)];
+	}
+}
+
+void MBC::flushRAM()
+{
+	if (ram.flush() && ramMapped)
+	{
+		ramMapped = false;
+		mapRAM(ramBank, ramWritable); // the pages are clean again
+	}
+}
+
+void NoMBC::map()
+{
+	MBC::map();
+	mapRAM(0); // always enabled
+}
+
+void MBC1::write(addr16 addr, byte val)
+{
+	if (addr < 0x2000)
+	{
+		ramEnabled = (val & 0x0F) == 0x0A;
+	}
+	else if (addr < 0x4000)
+	{
+		bank1 = val & 0x1F;
+		if (bank1 == 0)
+		{
+			bank1 = 1;
+		}
+	}
+	else if (addr < 0x6000)
+	{
+		bank2 = val & 0x3;
+	}
+	else if (addr < 0x8000)
+	{
+		mode = (val & 0x1) ? memmodes::RAM_BANK : memmodes::ROM_BANK;
+	}
+	else
+	{
+		writeRAM(addr, val);
+		return;
+	}
+	update();
+}
+
+void MBC1::update()
+{
+	mapROM((bank2 << 5) | bank1);
+	// in RAM banking mode the upper bits also switch the RAM bank and the bank at 0x0000
+	mapROM0(mode == memmodes::RAM_BANK ? bank2 << 5 : 0);
+	if (ramEnabled)
+	{
+		mapRAM(mode == memmodes::RAM_BANK ? bank2 : 0);
+	}
+	else
+	{
+		unmapRAM();
+	}
+}
+
+void MBC2::write(addr16 addr, byte val)
+{
+	if (addr < 0x4000)
+	{
+		if ((addr & 0x100) == 0) // bit 8 of the address picks the register
+		{
+			ramEnabled = (val & 0x0F) == 0x0A;
+			if (ramEnabled)
+			{
+				mapRAM(0, false); // the 512 4 bit cells repeat through 0xA000-0xBFFF
+			}
+			else
+			{
+				unmapRAM();
+			}
+		}
+		else
+		{
+			mapROM((val & 0x0F) == 0 ? 1 : val & 0x0F);
+		}
+	}
+	else
+	{
+		writeRAM(addr, val | 0xF0, false); // only the low 4 bits exist, so writes always come through here
+	}
+}
+
+byte MBC3::read(addr16 addr) const
+{
+	if (ramEnabled && ramSelect >= 0x08 && ramSelect <= 0x0C)
+	{
+		return latchedRTC[ramSelect - 0x08];
+	}
+	return static_cast<byte>(0xFF);
+}
+
+void MBC3::write(addr16 addr, byte val)
+{
+	if (addr < 0x2000)
+	{
+		ramEnabled = (val & 0x0F) == 0x0A;
+	}
+	else if (addr < 0x4000)
+	{
+		romBank = val & 0x7F;
+		if (romBank == 0)
+		{
+			romBank = 1;
+		}
+	}
+	else if (addr < 0x6000)
+	{
+		ramSelect = val & 0x0F;
+	}
+	else if (addr < 0x8000)
+	{
+		if (latch == 0x00 && val == 0x01) // latch on a 0 then 1 write
+		{
+			memcpy(latchedRTC, rtc, sizeof(rtc));
+		}
+		latch = val;
+		return;
+	}
+	else
+	{
+		if (ramEnabled && ramSelect >= 0x08 && ramSelect <= 0x0C)
+		{
+			rtc[ramSelect - 0x08] = val;
+		}
+		else
+		{
+			writeRAM(addr, val);
+		}
+		return;
+	}
+	update();
+}
+
+void MBC3::update()
+{
+	mapROM(romBank);
+	if (ramEnabled && ramSelect <= 0x03)
+	{
+		mapRAM(ramSelect);
+	}
+	else
+	{
+		unmapRAM(); // disabled or a clock register
+	}
+}
+
+void MBC5::write(addr16 addr, byte val)
+{
+	if (addr < 0x2000)
+	{
+		ramEnabled = (val & 0x0F) == 0x0A;
+	}
+	else if (addr < 0x3000)
+	{
+		romBank = (romBank & 0x100) | static_cast<ubyte>(val); // bank 0 can be selected
+	}
+	else if (addr < 0x4000)
+	{
+		romBank = (romBank & 0xFF) | ((val & 0x1) << 8);
+	}
+	else if (addr < 0x6000)
+	{
+		ramSelect = val & 0x0F;
+	}
+	else if (addr >= CART_RAM)
+	{
+		writeRAM(addr, val);
+		return;
+	}
+	else
+	{
+		return;
+	}
+	update();
+}
+
+void MBC5::update()
+{
+	mapROM(romBank);
+	if (ramEnabled)
+	{
+		mapRAM(ramSelect);
+	}
+	else
+	{
+		unmapRAM();
+	}
+}
+
+std::unique_ptr<MBC> createMBC(int type, const byte* rom, int numROMBanks, CartRAM& ram, MemoryMap* memMap)
+{
+	switch (type)
+	{
+		case ROM_ONLY:
+		case ROM_RAM:
+		case ROM_RAM_BATT:
+			return std::unique_ptr<MBC>(new NoMBC(rom, numROMBanks, ram, memMap));
+		case ROM_MBC1:
+		case ROM_MBC1_RAM:
+		case ROM_MBC1_RAM_BATT:
+			return std::unique_ptr<MBC>(new MBC1(rom, numROMBanks, ram, memMap));
+		case ROM_MBC2:
+		case ROM_MBC2_BATT:
+			return std::unique_ptr<MBC>(new MBC2(rom, numROMBanks, ram, memMap));
+		case ROM_MBC3_TIMER_BATT:
+		case ROM_MBC3_TIMER_RAM_BATT:
+		case ROM_MBC3:
+		case ROM_MBC3_RAM:
+		case ROM_MBC3_RAM_BATT:
+			return std::unique_ptr<MBC>(new MBC3(rom, numROMBanks, ram, memMap));
+		case ROM_MBC5:
+		case ROM_MBC5_RAM:
+		case ROM_MBC5_RAM_BATT:
+		case ROM_MBC5_RUMBLE:
+		case ROM_MBC5_RUMBLE_SRAM:
+		case ROM_MBC5_RUMLE_SRAM_BATT:
+			return std::unique_ptr<MBC>(new MBC5(rom, numROMBanks, ram, memMap));
+		default:
+			return nullptr;
+	}
+}
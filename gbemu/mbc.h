@@ -0,0 +1,144 @@
+#ifndef GB_MBC_H
+#define GB_MBC_H
+
+#include <memory>
+#include <vector>
+
+#include "types.h"
+#include "memmap.h"
+#include "savefile.h"
+
+const int ramBankSize = 0x2000; // bytes
+
+// The cart's RAM, all of its banks in one contiguous block
+// Battery backed RAM lives in a mapped save file and keeps track of which of its 256 byte pages have been written since the last flush:
+// clean pages are mapped read only so the first write to each goes through the controller and marks it, every later write is a plain store
+struct CartRAM
+{
+	byte* data = nullptr;
+	size_t size = 0;
+
+	SaveFile* save = nullptr; // nullptr if the RAM isn't battery backed
+	std::vector<bool> dirty; // per page
+
+	bool empty() const { return size == 0; }
+	bool tracked() const { return save != nullptr; }
+	bool writable(size_t offset) const { return !tracked() || dirty[offset / PAGE_SIZE]; }
+
+	void markDirty(size_t offset) { if (tracked()) dirty[offset / PAGE_SIZE] = true; }
+	bool flush(); // starts writing back the dirty pages, @return false if there weren't any
+};
+
+// Memory bank controllers
+// Each one maps its current ROM and RAM banks straight into the CPU's memory map and only remaps them when a bank register is written
+// so reads never go through the controller. The controller is only called for writes to its registers (0x0000-0x7FFF)
+// and for cart RAM accesses while the RAM is unmapped (disabled, MBC2's 4 bit RAM, MBC3's clock registers)
+class MBC
+{
+public:
+	// @param rom is the full ROM image, numROMBanks 16 KB banks long
+	// @param ram is the cart's SRAM
+	MBC(const byte* rom, int numROMBanks, CartRAM& ram, MemoryMap* memMap);
+	virtual ~MBC() {}
+
+	virtual void map(); // maps the power on banks
+	virtual byte read(addr16 addr) const { return static_cast<byte>(0xFF); }
+	virtual void write(addr16 addr, byte val) = 0;
+
+	void flushRAM(); // at the end of a frame
+
+protected:
+	void mapROM0(int bank);	// the bank at 0x0000
+	void mapROM(int bank);	// the bank at 0x4000
+	void mapRAM(int bank, bool writable = true); // the RAM bank at 0xA000, smaller RAMs repeat through it
+	void unmapRAM();
+	// Writes to the mapped RAM bank that weren't stores through the memory map (clean pages of battery RAM, MBC2)
+	// @param mapPage maps the page for writes once it is dirty
+	void writeRAM(addr16 addr, byte val, bool mapPage = true);
+
+	const byte* rom;
+	int numROMBanks;
+	CartRAM& ram;
+	MemoryMap* memMap;
+
+	// the mapped banks, they are only remapped when they change
+	const byte* rom0Base = nullptr;
+	const byte* romNBase = nullptr;
+	bool ramMapped = false;	// the RAM bank at 0xA000
+	int ramBank = 0;
+	bool ramWritable = false;
+};
+
+// Carts without a controller, with or without RAM
+class NoMBC : public MBC
+{
+public:
+	using MBC::MBC;
+	void map() override;
+	void write(addr16 addr, byte val) override { writeRAM(addr, val); }
+};
+
+class MBC1 : public MBC
+{
+public:
+	using MBC::MBC;
+	void write(addr16 addr, byte val) override;
+
+private:
+	void update();
+
+	bool ramEnabled = false;
+	int bank1 = 1; // lower 5 bits of the ROM bank
+	int bank2 = 0; // upper 2 bits of the ROM bank or the RAM bank
+	int mode = 0; // see memmodes in cart.h
+};
+
+class MBC2 : public MBC
+{
+public:
+	using MBC::MBC;
+	void write(addr16 addr, byte val) override;
+
+private:
+	bool ramEnabled = false;
+};
+
+class MBC3 : public MBC
+{
+public:
+	using MBC::MBC;
+	byte read(addr16 addr) const override;
+	void write(addr16 addr, byte val) override;
+
+private:
+	void update();
+
+	bool ramEnabled = false;
+	int romBank = 1;
+	int ramSelect = 0; // 0x08-0x0C select a clock register
+	// The clock registers (seconds, minutes, hours, day low, day high)
+	// They are kept and latched but don't count yet
+	byte rtc[5] = {};
+	byte latchedRTC[5] = {};
+	byte latch = static_cast<byte>(0xFF);
+};
+
+class MBC5 : public MBC
+{
+public:
+	using MBC::MBC;
+	void write(addr16 addr, byte val) override;
+
+private:
+	void update();
+
+	bool ramEnabled = false;
+	int romBank = 1;
+	int ramSelect = 0;
+};
+
+// @param type is the CART_TYPE byte from the ROM header
+// @return the controller for the type, or nullptr if it is unsupported
+std::unique_ptr<MBC> createMBC(int type, const byte* rom, int numROMBanks, CartRAM& ram, MemoryMap* memMap);
+
+#endif // GB_MBC_H
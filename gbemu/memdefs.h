@@ -97,6 +97,10 @@
 
 // Memory locations of various memory registers
 
+// serial port registers
+#define SB 0xFF01 // transfer data
+#define SC 0xFF02 // transfer control
+
 // timer registers
 #define DIV	 0xFF04
 #define TIMA 0xFF05
@@ -128,6 +132,8 @@
 #define SCY	 0xFF42 // background scroll y
 #define SCX	 0xFF43 // background scroll x
 #define LY	 0xFF44 // lcd y coordinate, Values range from 0->153. 144->153 is the VBlank period.
+#define LINE_CYCLES 456 // clock cycles per line
+#define NUM_LINES 154 // lines per frame, including the vblank
 #define LYC	 0xFF45 // ly compare
 #define DMA	 0xFF46 // DMA transfer
 #define BGP	 0xFF47 // palette data
@@ -0,0 +1,37 @@
+#ifndef GB_MEMMAP_H
+#define GB_MEMMAP_H
+
+#include <cstddef>
+
+#include "types.h"
+
+#define PAGE_SIZE 0x100
+#define NUM_PAGES 0x100 // 256 byte pages cover the full 16 bit address space
+
+// The CPU's view of the address space as 256 byte pages
+// Each entry points at the host memory backing the page, so most reads and writes are a single indexed load/ store
+// A nullptr entry means the page has side effects (mmio, MBC registers, mirrored RAM) and accesses go through a handler
+struct MemoryMap
+{
+	const byte* read[NUM_PAGES];
+	byte* write[NUM_PAGES];
+
+	// Maps the pages of [start, start + size) to the host memory at mem, a nullptr unmaps them
+	void mapRead(addr16 start, size_t size, const byte* mem)
+	{
+		for (size_t offset = 0; offset < size; offset += PAGE_SIZE)
+		{
+			read[(start + offset) >> 8] = mem == nullptr ? nullptr : mem + offset;
+		}
+	}
+
+	void mapWrite(addr16 start, size_t size, byte* mem)
+	{
+		for (size_t offset = 0; offset < size; offset += PAGE_SIZE)
+		{
+			write[(start + offset) >> 8] = mem == nullptr ? nullptr : mem + offset;
+		}
+	}
+};
+
+#endif // GB_MEMMAP_H
@@ -0,0 +1,159 @@
+#include <cstring>
+
+#include "pixels.h"
+
+#if !defined(GB_NO_SIMD) && defined(__AVX2__)
+#define GB_AVX2
+#include <immintrin.h>
+#endif
+#if !defined(GB_NO_SIMD) && (defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2))
+#define GB_SSE2
+#include <emmintrin.h>
+#endif
+
+#ifdef GB_SSE2
+// Spreads the bits of each byte of bits across 8 bytes (per row) and turns them into <value> or 0
+// @param bits is 2 rows' bytes, each repeated 8 times
+// @param masks is the bit each byte tests, in the order the pixels are stored
+static inline __m128i spreadBits(__m128i bits, __m128i masks, __m128i value)
+{
+	return _mm_and_si128(_mm_cmpeq_epi8(_mm_and_si128(bits, masks), masks), value);
+}
+#endif
+
+void decodeTile(const byte* data, ubyte* pixels, ubyte* flipped)
+{
+#ifdef GB_SSE2
+	// split the 8 rows' low and high bytes apart
+	const __m128i tile = _mm_loadu_si128(reinterpret_cast<const __m128i*>(data));
+	const __m128i lo = _mm_packus_epi16(_mm_and_si128(tile, _mm_set1_epi16(0x00FF)), _mm_setzero_si128());
+	const __m128i hi = _mm_packus_epi16(_mm_srli_epi16(tile, 8), _mm_setzero_si128());
+	// and repeat each one 4 times, lo4 is lo0 x4, lo1 x4 ... lo7 x4
+	const __m128i lo2 = _mm_unpacklo_epi8(lo, lo);
+	const __m128i hi2 = _mm_unpacklo_epi8(hi, hi);
+	const __m128i lo4[2] = { _mm_unpacklo_epi16(lo2, lo2), _mm_unpackhi_epi16(lo2, lo2) };
+	const __m128i hi4[2] = { _mm_unpacklo_epi16(hi2, hi2), _mm_unpackhi_epi16(hi2, hi2) };
+
+	const __m128i masks = _mm_set_epi8(0x01, 0x02, 0x04, 0x08, 0x10, 0x20, 0x40, static_cast<char>(0x80), 0x01, 0x02, 0x04, 0x08, 0x10, 0x20, 0x40, static_cast<char>(0x80));
+	const __m128i flippedMasks = _mm_set_epi8(static_cast<char>(0x80), 0x40, 0x20, 0x10, 0x08, 0x04, 0x02, 0x01, static_cast<char>(0x80), 0x40, 0x20, 0x10, 0x08, 0x04, 0x02, 0x01);
+	const __m128i one = _mm_set1_epi8(1);
+	const __m128i two = _mm_set1_epi8(2);
+	for (int i = 0; i < 4; i++) // 2 rows at a time
+	{
+		// lo8 is row i * 2's low byte x8 then row i * 2 + 1's
+		const __m128i lo8 = (i & 1) == 0 ? _mm_unpacklo_epi32(lo4[i / 2], lo4[i / 2]) : _mm_unpackhi_epi32(lo4[i / 2], lo4[i / 2]);
+		const __m128i hi8 = (i & 1) == 0 ? _mm_unpacklo_epi32(hi4[i / 2], hi4[i / 2]) : _mm_unpackhi_epi32(hi4[i / 2], hi4[i / 2]);
+		const __m128i rows = _mm_or_si128(spreadBits(lo8, masks, one), spreadBits(hi8, masks, two));
+		const __m128i flippedRows = _mm_or_si128(spreadBits(lo8, flippedMasks, one), spreadBits(hi8, flippedMasks, two));
+		_mm_storeu_si128(reinterpret_cast<__m128i*>(pixels + i * 16), rows);
+		_mm_storeu_si128(reinterpret_cast<__m128i*>(flipped + i * 16), flippedRows);
+	}
+#else
+	// https://slashbinbash.wordpress.com/2013/02/07/gameboy-tile-mapping-between-image-and-memory/
+	for (int y = 0; y < 8; y++)
+	{
+		const ubyte lo = data[y * 2];
+		const ubyte hi = data[y * 2 + 1];
+		for (int x = 0; x < 8; x++)
+		{
+			const ubyte color = (((hi >> (7 - x)) & 0x1) << 1) | ((lo >> (7 - x)) & 0x1);
+			pixels[y * 8 + x] = color;
+			flipped[y * 8 + 7 - x] = color;
+		}
+	}
+#endif
+}
+
+void applyPalette(const ubyte* colors, int count, ubyte palette, ubyte* shades)
+{
+	const ubyte table[4] = { static_cast<ubyte>(palette & 0x3), static_cast<ubyte>((palette >> 2) & 0x3), static_cast<ubyte>((palette >> 4) & 0x3), static_cast<ubyte>((palette >> 6) & 0x3) };
+	int i = 0;
+#if defined(GB_AVX2)
+	// a byte shuffle is a 16 entry lookup, only the first 4 are used
+	const __m256i lut = _mm256_setr_epi8(table[0], table[1], table[2], table[3], 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+		table[0], table[1], table[2], table[3], 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0);
+	for (; i + 32 <= count; i += 32)
+	{
+		const __m256i c = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(colors + i));
+		_mm256_storeu_si256(reinterpret_cast<__m256i*>(shades + i), _mm256_shuffle_epi8(lut, c));
+	}
+#endif
+#if defined(GB_SSE2)
+	const __m128i entries[4] = { _mm_set1_epi8(table[0]), _mm_set1_epi8(table[1]), _mm_set1_epi8(table[2]), _mm_set1_epi8(table[3]) };
+	for (; i + 16 <= count; i += 16)
+	{
+		const __m128i c = _mm_loadu_si128(reinterpret_cast<const __m128i*>(colors + i));
+		__m128i result = _mm_and_si128(_mm_cmpeq_epi8(c, _mm_setzero_si128()), entries[0]);
+		for (int n = 1; n < 4; n++)
+		{
+			result = _mm_or_si128(result, _mm_and_si128(_mm_cmpeq_epi8(c, _mm_set1_epi8(n)), entries[n]));
+		}
+		_mm_storeu_si128(reinterpret_cast<__m128i*>(shades + i), result);
+	}
+#endif
+	for (; i < count; i++)
+	{
+		shades[i] = table[colors[i] & 0x3];
+	}
+}
+
+void expandPixels(const ubyte* indices, int count, const uint32_t* lut, uint32_t* pixels)
+{
+	int i = 0;
+#if defined(GB_AVX2)
+	const __m256i table = _mm256_setr_epi32(lut[0], lut[1], lut[2], lut[3], lut[0], lut[1], lut[2], lut[3]);
+	for (; i + 8 <= count; i += 8)
+	{
+		const __m256i index = _mm256_cvtepu8_epi32(_mm_loadl_epi64(reinterpret_cast<const __m128i*>(indices + i)));
+		_mm256_storeu_si256(reinterpret_cast<__m256i*>(pixels + i), _mm256_permutevar8x32_epi32(table, index));
+	}
+#endif
+#if defined(GB_SSE2)
+	const __m128i entries[4] = { _mm_set1_epi32(lut[0]), _mm_set1_epi32(lut[1]), _mm_set1_epi32(lut[2]), _mm_set1_epi32(lut[3]) };
+	for (; i + 4 <= count; i += 4)
+	{
+		uint32_t packed;
+		memcpy(&packed, indices + i, sizeof(packed));
+		const __m128i bytes = _mm_cvtsi32_si128(static_cast<int>(packed));
+		const __m128i index = _mm_unpacklo_epi16(_mm_unpacklo_epi8(bytes, _mm_setzero_si128()), _mm_setzero_si128());
+		__m128i result = _mm_and_si128(_mm_cmpeq_epi32(index, _mm_setzero_si128()), entries[0]);
+		for (int n = 1; n < 4; n++)
+		{
+			result = _mm_or_si128(result, _mm_and_si128(_mm_cmpeq_epi32(index, _mm_set1_epi32(n)), entries[n]));
+		}
+		_mm_storeu_si128(reinterpret_cast<__m128i*>(pixels + i), result);
+	}
+#endif
+	for (; i < count; i++)
+	{
+		pixels[i] = lut[indices[i] & 0x3];
+	}
+}
+
+uint64_t findSprites(const ubyte* ys, int ly, int height)
+{
+	// sprites are offset by 16, sprite n covers ly if ly + 16 - y is in [0, height)
+	// it is done in bytes, ly + 16 - y wraps around to at least 17 when y is past ly + 16
+	const ubyte top = static_cast<ubyte>(ly + 16);
+	uint64_t mask = 0;
+#if defined(GB_SSE2)
+	const __m128i topV = _mm_set1_epi8(static_cast<char>(top));
+	const __m128i last = _mm_set1_epi8(static_cast<char>(height - 1));
+	for (int i = 0; i < SPRITE_YS; i += 16)
+	{
+		const __m128i row = _mm_sub_epi8(topV, _mm_loadu_si128(reinterpret_cast<const __m128i*>(ys + i)));
+		// unsigned row <= last
+		const __m128i covers = _mm_cmpeq_epi8(_mm_min_epu8(row, last), row);
+		mask |= static_cast<uint64_t>(static_cast<uint16_t>(_mm_movemask_epi8(covers))) << i;
+	}
+#else
+	for (int i = 0; i < SPRITE_YS; i++)
+	{
+		if (static_cast<ubyte>(top - ys[i]) < height)
+		{
+			mask |= static_cast<uint64_t>(1) << i;
+		}
+	}
+#endif
+	return mask;
+}
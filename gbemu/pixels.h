@@ -0,0 +1,32 @@
+#ifndef GB_PIXELS_H
+#define GB_PIXELS_H
+
+#include <cstdint>
+
+#include "types.h"
+
+// Pixel conversion and sprite search kernels for the PPU
+// They are vectorized with AVX2 or SSE2 when the compiler targets them (MSVC: /arch:AVX2, g++: -mavx2) and fall back to plain loops otherwise
+// Define GB_NO_SIMD to always use the plain loops
+
+// Decodes the 8 rows (16 bytes) of a 2bpp tile to one color number (0-3) per pixel
+// @param data is the tile's 16 bytes, a low and a high bitplane byte per row
+// @param pixels is 64 color numbers, row by row, left to right
+// @param flipped is the same tile flipped horizontally
+void decodeTile(const byte* data, ubyte* pixels, ubyte* flipped);
+
+// Maps color numbers through a palette register (BGP, OBP0, OBP1) to shades (0-3)
+void applyPalette(const ubyte* colors, int count, ubyte palette, ubyte* shades);
+
+// Expands indices (0-3) to 32 bit host pixels through a 4 entry table
+void expandPixels(const ubyte* indices, int count, const uint32_t* lut, uint32_t* pixels);
+
+#define SPRITE_YS 48 // the sprites' Y bytes are padded out to a whole number of vectors
+
+// Finds the sprites that cover a line
+// @param ys is the 40 sprites' Y bytes from OAM followed by zeroes (off screen) up to SPRITE_YS
+// @param ly is the line, height is 8 or 16
+// @return bit n is set if sprite n covers the line
+uint64_t findSprites(const ubyte* ys, int ly, int height);
+
+#endif // GB_PIXELS_H
@@ -0,0 +1,258 @@
+#include <algorithm>
+#include <cstring>
+
+#include "ppu.h"
+
+// Resources:
+// * http://gbdev.gg8.se/wiki/articles/Video_Display
+
+TileCache::TileCache(const byte* vram)
+	: vram(vram)
+{
+	invalidateAll();
+}
+
+void TileCache::invalidateAll()
+{
+	for (bool& tile : valid)
+	{
+		tile = false;
+	}
+}
+
+void TileCache::decode(int tile)
+{
+	// the two bytes of a row are the low and high bits of its 8 pixels' color numbers, bit 7 is the leftmost pixel
+	decodeTile(&vram[tile * 0x10], &pixels[0][tile][0][0], &pixels[1][tile][0][0]);
+	valid[tile] = true;
+}
+
+BGPlane::BGPlane(const byte* vram, addr16 map)
+	: vram(vram), map(map)
+{
+	memset(dirtyEntries, 0, sizeof(dirtyEntries));
+	memset(dirtyTiles, 0, sizeof(dirtyTiles));
+}
+
+const ubyte* BGPlane::update(TileCache& tiles, ubyte lcdc)
+{
+	const bool redrawAll = tileData != (lcdc & lcdcTileData);
+	tileData = lcdc & lcdcTileData;
+	const byte* entries = &vram[map - CHARACTER_RAM];
+	for (int entry = 0; entry < MAP_ENTRIES; entry++)
+	{
+		const int tile = bgTile(entries[entry], lcdc);
+		if (!redrawAll && !dirtyEntries[entry] && !dirtyTiles[tile])
+		{
+			continue;
+		}
+		const int x = (entry & 0x1F) * 8;
+		const int y = (entry >> 5) * 8;
+		for (int row = 0; row < 8; row++)
+		{
+			memcpy(&pixels[y + row][x], tiles.row(tile, row, false), 8);
+		}
+	}
+	memset(dirtyEntries, 0, sizeof(dirtyEntries));
+	memset(dirtyTiles, 0, sizeof(dirtyTiles));
+	return &pixels[0][0];
+}
+
+PPU::PPU(CPU& cpu)
+	: cpu(cpu), tiles(cpu.videoRAM())
+{
+	cpu.setVRAMListener(this);
+}
+
+PPU::~PPU()
+{
+	cpu.setVRAMListener(nullptr);
+}
+
+void PPU::vramWritten(addr16 addr)
+{
+	if (addr <= CHR_MAP_END)
+	{
+		const int tile = (addr - CHR_MAP) / 0x10;
+		tiles.invalidate(tile);
+		for (const auto& plane : planes)
+		{
+			if (plane != nullptr)
+			{
+				plane->tileWritten(tile);
+			}
+		}
+	}
+	else
+	{
+		const auto& plane = planes[(addr - BG_MAP_0) / MAP_ENTRIES];
+		if (plane != nullptr)
+		{
+			plane->mapWritten((addr - BG_MAP_0) % MAP_ENTRIES);
+		}
+	}
+}
+
+const ubyte* PPU::background(int map)
+{
+	if (planes[map] == nullptr)
+	{
+		planes[map].reset(new BGPlane(cpu.videoRAM(), map == 0 ? BG_MAP_0 : BG_MAP_1)); // drawn in full by its first update
+	}
+	return planes[map]->update(tiles, cpu.rByte(LCDC));
+}
+
+void PPU::startFrame()
+{
+	windowLine = 0;
+}
+
+void PPU::renderLine(int ly)
+{
+	ubyte* line = frame[ly];
+	const ubyte lcdc = cpu.rByte(LCDC);
+	ubyte colors[LCD_WIDTH] = {}; // color 0 where the BG is off
+	if ((lcdc & lcdcEnable) != 0x0)
+	{
+		if ((lcdc & lcdcBGEnable) != 0x0)
+		{
+			drawBG(ly, lcdc, colors);
+			drawWindow(ly, lcdc, colors);
+		}
+	}
+
+	const ubyte bgp = cpu.rByte(BGP);
+	applyPalette(colors, LCD_WIDTH, bgp, line);
+
+	if ((lcdc & lcdcEnable) != 0x0 && (lcdc & lcdcSpriteEnable) != 0x0)
+	{
+		drawSprites(ly, lcdc, colors, line);
+	}
+}
+
+void PPU::drawTiles(addr16 map, ubyte lcdc, int mapX, int mapY, int start, ubyte* colors)
+{
+	const byte* vram = cpu.videoRAM();
+	const int row = mapY & 0x7;
+	const int mapRow = map + (mapY >> 3) * 32; // 32 tiles per line of the map
+	int x = start;
+	int fineX = mapX & 0x7; // the first tile is only partly on screen
+	for (int tileX = (mapX >> 3); x < LCD_WIDTH; tileX = (tileX + 1) & 0x1F) // wraps around the 32 tile wide map
+	{
+		const ubyte* pixels = tiles.row(bgTile(vram[mapRow + tileX - CHARACTER_RAM], lcdc), row, false);
+		const int count = std::min(8 - fineX, LCD_WIDTH - x);
+		memcpy(&colors[x], &pixels[fineX], count);
+		x += count;
+		fineX = 0;
+	}
+}
+
+void PPU::drawBG(int ly, ubyte lcdc, ubyte* colors)
+{
+	const addr16 map = (lcdc & lcdcBGMap) != 0x0 ? BG_MAP_1 : BG_MAP_0;
+	const ubyte scx = cpu.rByte(SCX);
+	const ubyte scy = cpu.rByte(SCY);
+	drawTiles(map, lcdc, scx, (ly + scy) & 0xFF, 0, colors);
+}
+
+void PPU::drawWindow(int ly, ubyte lcdc, ubyte* colors)
+{
+	const int wy = static_cast<ubyte>(cpu.rByte(WY));
+	const int wx = static_cast<ubyte>(cpu.rByte(WX)) - 7; // WX is offset by 7
+	if ((lcdc & lcdcWindowEnable) == 0x0 || ly < wy || wx >= LCD_WIDTH)
+	{
+		return;
+	}
+	const addr16 map = (lcdc & lcdcWindowMap) != 0x0 ? BG_MAP_1 : BG_MAP_0;
+	// a window partly off the left edge starts part way into its first tile
+	drawTiles(map, lcdc, wx < 0 ? -wx : 0, windowLine, wx < 0 ? 0 : wx, colors);
+	windowLine++;
+}
+
+const PPU::SpriteLine& PPU::spritesOnLine(int ly, int height)
+{
+	if (oamChanged || height != spriteHeight)
+	{
+		const byte* oam = cpu.oam();
+		for (int i = 0; i < 40; i++)
+		{
+			spriteYs[i] = oam[i * 4];
+		}
+		memset(&spriteYs[40], 0, SPRITE_YS - 40); // off screen
+		memset(spriteLineValid, 0, sizeof(spriteLineValid));
+		spriteHeight = height;
+		oamChanged = false;
+	}
+
+	SpriteLine& line = spriteLines[ly];
+	if (!spriteLineValid[ly])
+	{
+		// the first (up to) 10 sprites on this line, in OAM order
+		line.count = 0;
+		for (uint64_t found = findSprites(spriteYs, ly, height); found != 0 && line.count < 10; found &= found - 1)
+		{
+			line.sprites[line.count++] = static_cast<ubyte>(lowestBit(found));
+		}
+
+		// the sprite with the smaller x (then the earlier one in OAM) is on top
+		const byte* oam = cpu.oam();
+		for (int i = 1; i < line.count; i++)
+		{
+			for (int j = i; j > 0 && static_cast<ubyte>(oam[line.sprites[j] * 4 + 1]) < static_cast<ubyte>(oam[line.sprites[j - 1] * 4 + 1]); j--)
+			{
+				std::swap(line.sprites[j], line.sprites[j - 1]);
+			}
+		}
+		spriteLineValid[ly] = true;
+	}
+	return line;
+}
+
+void PPU::drawSprites(int ly, ubyte lcdc, const ubyte* colors, ubyte* line)
+{
+	const byte* oam = cpu.oam();
+	const int height = (lcdc & lcdcSpriteSize) != 0x0 ? 16 : 8;
+	const SpriteLine& sprites = spritesOnLine(ly, height);
+
+	// draw them from the bottom up
+	const ubyte obp0 = cpu.rByte(OBP0);
+	const ubyte obp1 = cpu.rByte(OBP1);
+	for (int i = sprites.count - 1; i >= 0; i--)
+	{
+		const byte* sprite = &oam[sprites.sprites[i] * 4];
+		const int y = static_cast<ubyte>(sprite[0]) - 16;
+		const int x = static_cast<ubyte>(sprite[1]) - 8;
+		const ubyte flags = sprite[3];
+		ubyte tile = sprite[2];
+		if (height == 16)
+		{
+			tile &= 0xFE; // the bottom bit is ignored for 8x16 sprites
+		}
+		int row = ly - y;
+		if ((flags & spriteYFlip) != 0x0)
+		{
+			row = height - 1 - row;
+		}
+		// sprites are always unsigned, an 8x16 sprite's rows run on into the next tile
+		const ubyte* pixels = tiles.row(tile + row / 8, row & 0x7, (flags & spriteXFlip) != 0x0);
+		const ubyte palette = (flags & spritePalette) != 0x0 ? obp1 : obp0;
+		for (int px = 0; px < 8; px++)
+		{
+			const int screenX = x + px;
+			if (screenX < 0 || screenX >= LCD_WIDTH)
+			{
+				continue;
+			}
+			const ubyte color = pixels[px];
+			if (color == 0) // color 0 is clear for sprites
+			{
+				continue;
+			}
+			if ((flags & spriteBehindBG) != 0x0 && colors[screenX] != 0)
+			{
+				continue;
+			}
+			line[screenX] = shade(palette, color);
+		}
+	}
+}
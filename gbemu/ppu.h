@@ -0,0 +1,159 @@
+#ifndef GB_PPU_H
+#define GB_PPU_H
+
+#include <memory>
+
+#include "cpu.h"
+#include "memdefs.h"
+#include "types.h"
+#include "pixels.h"
+
+#define LCD_WIDTH 160
+#define LCD_HEIGHT 144
+
+// Bits of the lcd control register (LCDC)
+enum LCDCBits
+{
+	lcdcBGEnable = 0x01,
+	lcdcSpriteEnable = 0x02,
+	lcdcSpriteSize = 0x04, // 0 = 8x8, 1 = 8x16
+	lcdcBGMap = 0x08, // 0 = BG_MAP_0, 1 = BG_MAP_1
+	lcdcTileData = 0x10, // 0 = CHR_MAP_SIGNED, 1 = CHR_MAP_UNSIGNED
+	lcdcWindowEnable = 0x20,
+	lcdcWindowMap = 0x40, // 0 = BG_MAP_0, 1 = BG_MAP_1
+	lcdcEnable = 0x80,
+};
+
+// Bits of a sprite's attribute byte in OAM
+enum SpriteFlags
+{
+	spritePalette = 0x10, // 0 = OBP0, 1 = OBP1
+	spriteXFlip = 0x20,
+	spriteYFlip = 0x40,
+	spriteBehindBG = 0x80, // drawn behind BG colors 1-3
+};
+
+#define NUM_TILES 384 // in CHR_MAP
+#define BG_SIZE 256 // the tile maps are 32x32 tiles
+#define MAP_ENTRIES (32 * 32)
+
+// @return the number in CHR_MAP of the tile a BG/ window map entry refers to
+inline int bgTile(ubyte tile, ubyte lcdc)
+{
+	// signed characters, tile 0 is in the middle of CHR_MAP_SIGNED
+	return (lcdc & lcdcTileData) != 0x0 ? tile : 0x100 + static_cast<sbyte>(tile);
+}
+
+// All of the tiles in video RAM decoded to color numbers (0-3), one byte per pixel, along with their horizontally flipped versions
+// Tiles are decoded the first time they are drawn after they change, drawing a tile row is then a copy of 8 bytes
+class TileCache
+{
+public:
+	TileCache(const byte* vram);
+
+	// @param tile is the tile's number in CHR_MAP (its offset / 0x10)
+	void invalidate(int tile) { valid[tile] = false; }
+	void invalidateAll();
+
+	// @return the 8 color numbers of row <y> of <tile>, left to right
+	inline const ubyte* row(int tile, int y, bool xflip)
+	{
+		if (!valid[tile])
+		{
+			decode(tile);
+		}
+		return pixels[xflip ? 1 : 0][tile][y];
+	}
+
+private:
+	const byte* vram;
+	ubyte pixels[2][NUM_TILES][8][8]; // [xflip][tile][y][x]
+	bool valid[NUM_TILES];
+
+	void decode(int tile);
+};
+
+// The whole 256x256 background of one tile map in color numbers, for debug views and anything else that wants more than a line
+// It is kept between frames and only the tiles whose map entry or tile data changed are redrawn (all of them when LCDC switches the tile data)
+class BGPlane
+{
+public:
+	BGPlane(const byte* vram, addr16 map);
+
+	void mapWritten(int entry) { dirtyEntries[entry] = true; }
+	void tileWritten(int tile) { dirtyTiles[tile] = true; }
+
+	// Redraws the changed tiles
+	// @return BG_SIZE rows of BG_SIZE color numbers
+	const ubyte* update(TileCache& tiles, ubyte lcdc);
+
+private:
+	const byte* vram;
+	addr16 map;
+	ubyte pixels[BG_SIZE][BG_SIZE];
+	bool dirtyEntries[MAP_ENTRIES];
+	bool dirtyTiles[NUM_TILES];
+	int tileData = -1; // the LCDC tile data select the plane was drawn with, -1 before it is drawn
+};
+
+// Draws the screen a line at a time straight from the cpu's video memory and LCD registers
+// Each line is drawn with the registers as they are when it starts, so mid frame scroll changes show up where they happen
+class PPU : public VRAMListener
+{
+public:
+	PPU(CPU& cpu);
+	~PPU();
+
+	void vramWritten(addr16 addr) override;
+	void oamWritten() override { oamChanged = true; }
+
+	// Call before drawing line 0
+	void startFrame();
+
+	// Draws a single line of the background, window and sprites into the frame buffer
+	// @param ly is the line to draw
+	void renderLine(int ly);
+
+	// @return the frame, LCD_HEIGHT rows of LCD_WIDTH shades, 0 (white) to 3 (black)
+	// The front end turns it into host pixels once the frame is done
+	const ubyte* frameBuffer() const { return &frame[0][0]; }
+
+	// @param map is 0 for BG_MAP_0 or 1 for BG_MAP_1
+	// @return the map's full background as it is now, BG_SIZE rows of BG_SIZE color numbers (before the palette)
+	const ubyte* background(int map);
+
+private:
+	CPU& cpu;
+	TileCache tiles;
+	std::unique_ptr<BGPlane> planes[2]; // BG_MAP_0, BG_MAP_1, allocated by the first background() call so PPUs without a debug view don't carry them
+	ubyte frame[LCD_HEIGHT][LCD_WIDTH] = {};
+	int windowLine = 0; // the line of the window to draw next, the window only moves down on lines it is drawn on
+
+	// The sprites drawn on each line, found the first time the line is drawn after OAM (or the sprite size) changes
+	struct SpriteLine
+	{
+		int count;
+		ubyte sprites[10]; // OAM indices, from the top sprite down
+	};
+	SpriteLine spriteLines[LCD_HEIGHT];
+	bool spriteLineValid[LCD_HEIGHT];
+	ubyte spriteYs[SPRITE_YS]; // copy of the sprites' Y bytes for findSprites
+	int spriteHeight = 0; // that the lines were found for
+	bool oamChanged = true;
+
+	const SpriteLine& spritesOnLine(int ly, int height);
+
+	// @param colors is the line's BG/ window color numbers (before the palette), sprites need them for priority
+	void drawBG(int ly, ubyte lcdc, ubyte* colors);
+	void drawWindow(int ly, ubyte lcdc, ubyte* colors);
+	void drawSprites(int ly, ubyte lcdc, const ubyte* colors, ubyte* line);
+
+	// Draws pixels [start, LCD_WIDTH) of a line from a tile map
+	// @param mapX and mapY are the coordinates in the 256x256 tile map of the pixel at start
+	void drawTiles(addr16 map, ubyte lcdc, int mapX, int mapY, int start, ubyte* colors);
+
+	// @return the shade of color number <color> in palette register <palette>
+	static inline ubyte shade(ubyte palette, ubyte color) { return (palette >> (color * 2)) & 0x3; }
+};
+
+#endif // GB_PPU_H
@@ -0,0 +1,187 @@
+#include <fstream>
+#include <cstring>
+
+// before our headers, memdefs.h defines short register names as macros
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+#include "romfile.h"
+#include "cart.h"
+
+ROMFile::~ROMFile()
+{
+	close();
+}
+
+ROMFile::ROMFile(ROMFile&& other)
+{
+	*this = std::move(other);
+}
+
+ROMFile& ROMFile::operator=(ROMFile&& other)
+{
+	if (this != &other)
+	{
+		close();
+		rom = other.rom;
+		romSize = other.romSize;
+		padded = std::move(other.padded);
+#ifdef _WIN32
+		mapping = other.mapping;
+		other.mapping = nullptr;
+#endif
+		mapped = other.mapped;
+		other.rom = nullptr;
+		other.romSize = 0;
+		other.mapped = false;
+	}
+	return *this;
+}
+
+bool ROMFile::open(const std::string& fileName)
+{
+	close();
+
+	// map the file
+#ifdef _WIN32
+	HANDLE file = CreateFileA(fileName.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+	if (file == INVALID_HANDLE_VALUE)
+	{
+		return false;
+	}
+	LARGE_INTEGER fileSize;
+	if (!GetFileSizeEx(file, &fileSize) || fileSize.QuadPart == 0)
+	{
+		CloseHandle(file);
+		return false;
+	}
+	romSize = static_cast<size_t>(fileSize.QuadPart);
+	if (romSize % banksize == 0)
+	{
+		mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+		if (mapping != nullptr)
+		{
+			rom = static_cast<const byte*>(MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0));
+			if (rom == nullptr)
+			{
+				CloseHandle(mapping);
+				mapping = nullptr;
+			}
+		}
+	}
+	CloseHandle(file); // the mapping keeps the file open
+#else
+	const int fd = ::open(fileName.c_str(), O_RDONLY);
+	if (fd < 0)
+	{
+		return false;
+	}
+	struct stat info;
+	if (fstat(fd, &info) != 0 || info.st_size == 0)
+	{
+		::close(fd);
+		return false;
+	}
+	romSize = static_cast<size_t>(info.st_size);
+	if (romSize % banksize == 0)
+	{
+		void* view = mmap(nullptr, romSize, PROT_READ, MAP_PRIVATE, fd, 0);
+		if (view != MAP_FAILED)
+		{
+			rom = static_cast<const byte*>(view);
+		}
+	}
+	::close(fd); // the mapping keeps the file open
+#endif
+
+	if (rom != nullptr)
+	{
+		mapped = true;
+		return true;
+	}
+
+	// couldn't map it, read it in instead
+	std::ifstream file(fileName, std::ios::in | std::ios::binary);
+	if (!file.is_open())
+	{
+		romSize = 0;
+		return false;
+	}
+	padded.assign((romSize + banksize - 1) / banksize * banksize, static_cast<byte>(0xFF));
+	file.read(reinterpret_cast<char*>(padded.data()), romSize);
+	romSize = padded.size();
+	rom = padded.data();
+	return true;
+}
+
+void ROMFile::close()
+{
+	if (mapped)
+	{
+#ifdef _WIN32
+		UnmapViewOfFile(rom);
+		CloseHandle(mapping);
+		mapping = nullptr;
+#else
+		munmap(const_cast<byte*>(rom), romSize);
+#endif
+		mapped = false;
+	}
+	padded.clear();
+	padded.shrink_to_fit();
+	rom = nullptr;
+	romSize = 0;
+}
+
+// FNV-1a over 8 byte words, ROMs are always a whole number of banks so there is no tail
+uint64_t ROMFile::hash() const
+{
+	uint64_t h = 0xCBF29CE484222325ULL;
+	for (size_t i = 0; i + sizeof(uint64_t) <= romSize; i += sizeof(uint64_t))
+	{
+		uint64_t word;
+		memcpy(&word, rom + i, sizeof(word));
+		h = (h ^ word) * 0x100000001B3ULL;
+	}
+	return h;
+}
+
+std::mutex ROMCache::lock;
+std::unordered_multimap<uint64_t, std::weak_ptr<const ROMFile>> ROMCache::images;
+
+std::shared_ptr<const ROMFile> ROMCache::load(const std::string& fileName)
+{
+	std::shared_ptr<ROMFile> rom = std::make_shared<ROMFile>();
+	if (!rom->open(fileName))
+	{
+		return nullptr;
+	}
+	const uint64_t key = rom->hash();
+
+	std::lock_guard<std::mutex> guard(lock);
+	auto range = images.equal_range(key);
+	for (auto it = range.first; it != range.second;)
+	{
+		std::shared_ptr<const ROMFile> cached = it->second.lock();
+		if (cached == nullptr)
+		{
+			it = images.erase(it); // every cart of it is gone
+			continue;
+		}
+		if (cached->size() == rom->size() && memcmp(cached->data(), rom->data(), rom->size()) == 0)
+		{
+			return cached; // the new mapping is dropped with rom
+		}
+		++it;
+	}
+	images.emplace(key, rom);
+	return rom;
+}
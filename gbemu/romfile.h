@@ -0,0 +1,63 @@
+#ifndef GB_ROMFILE_H
+#define GB_ROMFILE_H
+
+#include <string>
+#include <vector>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+#include <cstddef>
+#include <cstdint>
+
+#include "types.h"
+
+// A ROM file mapped read only into memory
+// The cart's banks are views into the mapping so loading a ROM doesn't copy it
+class ROMFile
+{
+public:
+	ROMFile() {}
+	~ROMFile();
+
+	ROMFile(ROMFile&& other);
+	ROMFile& operator=(ROMFile&& other);
+	ROMFile(const ROMFile&) = delete;
+	ROMFile& operator=(const ROMFile&) = delete;
+
+	// @return false if the file couldn't be opened or mapped
+	bool open(const std::string& fileName);
+	void close();
+
+	const byte* data() const { return rom; }
+	size_t size() const { return romSize; }
+
+	uint64_t hash() const; // of the contents
+
+private:
+	const byte* rom = nullptr;
+	size_t romSize = 0;
+
+	// ROMs that aren't a whole number of banks are read into here instead (padded with 0xFF)
+	// Mapping them would leave the end of the last bank past the end of the file
+	std::vector<byte> padded;
+
+#ifdef _WIN32
+	void* mapping = nullptr;
+#endif
+	bool mapped = false;
+};
+
+// Process wide cache of the ROMs in use, keyed by a hash of their contents
+// Every cart of the same ROM shares one read only image, which is unmapped when the last of them goes away
+class ROMCache
+{
+public:
+	// @return the shared image of the ROM in fileName, or nullptr if it couldn't be opened
+	static std::shared_ptr<const ROMFile> load(const std::string& fileName);
+
+private:
+	static std::mutex lock;
+	static std::unordered_multimap<uint64_t, std::weak_ptr<const ROMFile>> images;
+};
+
+#endif // GB_ROMFILE_H
@@ -0,0 +1,159 @@
+// before our headers, memdefs.h defines short register names as macros
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/file.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+#include "savefile.h"
+
+SaveFile::~SaveFile()
+{
+	close();
+}
+
+bool SaveFile::open(const std::string& fileName, size_t size)
+{
+	close();
+	if (size == 0)
+	{
+		return false;
+	}
+
+#ifdef _WIN32
+	// the share mode is the lock, nobody else can open the file for writing while we have it
+	HANDLE handle = CreateFileA(fileName.c_str(), GENERIC_READ | GENERIC_WRITE, FILE_SHARE_READ, nullptr, OPEN_ALWAYS, FILE_ATTRIBUTE_NORMAL, nullptr);
+	if (handle == INVALID_HANDLE_VALUE && GetLastError() == ERROR_SHARING_VIOLATION)
+	{
+		// another cart has it, play from a copy
+		handle = CreateFileA(fileName.c_str(), GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_WRITE, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+		if (handle == INVALID_HANDLE_VALUE)
+		{
+			return false;
+		}
+		copy.assign(size, 0);
+		DWORD bytesRead = 0;
+		ReadFile(handle, copy.data(), static_cast<DWORD>(size), &bytesRead, nullptr);
+		CloseHandle(handle);
+		mem = copy.data();
+		memSize = size;
+		return true;
+	}
+	if (handle == INVALID_HANDLE_VALUE)
+	{
+		return false;
+	}
+	// mapping more than the file holds grows it
+	mapping = CreateFileMappingA(handle, nullptr, PAGE_READWRITE, 0, static_cast<DWORD>(size), nullptr);
+	if (mapping == nullptr)
+	{
+		CloseHandle(handle);
+		return false;
+	}
+	mem = static_cast<byte*>(MapViewOfFile(mapping, FILE_MAP_WRITE, 0, 0, size));
+	if (mem == nullptr)
+	{
+		CloseHandle(mapping);
+		CloseHandle(handle);
+		mapping = nullptr;
+		return false;
+	}
+	file = handle;
+#else
+	const int handle = ::open(fileName.c_str(), O_RDWR | O_CREAT, 0644);
+	if (handle < 0)
+	{
+		return false;
+	}
+	// flock locks belong to the open file, so a second open in this process is refused too
+	if (flock(handle, LOCK_EX | LOCK_NB) != 0)
+	{
+		// another cart has it, play from a copy
+		copy.assign(size, 0);
+		const ssize_t bytesRead = pread(handle, copy.data(), size, 0);
+		::close(handle);
+		if (bytesRead < 0)
+		{
+			copy.clear();
+			return false;
+		}
+		mem = copy.data();
+		memSize = size;
+		return true;
+	}
+	struct stat info;
+	if (fstat(handle, &info) != 0 || (static_cast<size_t>(info.st_size) < size && ftruncate(handle, size) != 0))
+	{
+		::close(handle);
+		return false;
+	}
+	void* view = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, handle, 0);
+	if (view == MAP_FAILED)
+	{
+		::close(handle);
+		return false;
+	}
+	mem = static_cast<byte*>(view);
+	fd = handle; // closing it would drop the lock
+#endif
+	memSize = size;
+	return true;
+}
+
+void SaveFile::close()
+{
+	if (mem == nullptr)
+	{
+		return;
+	}
+	if (!writesBack())
+	{
+		copy.clear();
+		mem = nullptr;
+		memSize = 0;
+		return;
+	}
+	// wait for everything to reach the file
+#ifdef _WIN32
+	FlushViewOfFile(mem, memSize);
+	FlushFileBuffers(file);
+	UnmapViewOfFile(mem);
+	CloseHandle(mapping);
+	CloseHandle(file);
+	mapping = nullptr;
+	file = nullptr;
+#else
+	msync(mem, memSize, MS_SYNC);
+	munmap(mem, memSize);
+	::close(fd); // and unlock it
+	fd = -1;
+#endif
+	mem = nullptr;
+	memSize = 0;
+}
+
+void SaveFile::flush(size_t offset, size_t length)
+{
+	if (mem == nullptr || !writesBack() || offset >= memSize)
+	{
+		return;
+	}
+	if (offset + length > memSize)
+	{
+		length = memSize - offset;
+	}
+#ifdef _WIN32
+	FlushViewOfFile(mem + offset, length); // starts the writes, it doesn't wait for them
+#else
+	// msync needs a page aligned start, the mapping itself is page aligned
+	const size_t pageSize = static_cast<size_t>(sysconf(_SC_PAGESIZE));
+	const size_t start = offset / pageSize * pageSize;
+	msync(mem + start, length + (offset - start), MS_ASYNC);
+#endif
+}
@@ -0,0 +1,47 @@
+#ifndef GB_SAVEFILE_H
+#define GB_SAVEFILE_H
+
+#include <string>
+#include <vector>
+#include <cstddef>
+
+#include "types.h"
+
+// A battery save (.sav) file mapped read/ write into memory
+// Writes to the cart's RAM land straight in the file's pages, flushing only starts the write back of the ones that changed
+// The file is locked while it is open so only one cart saves to it, any other cart of the same game gets a private copy that is never written back
+class SaveFile
+{
+public:
+	SaveFile() {}
+	~SaveFile();
+
+	SaveFile(const SaveFile&) = delete;
+	SaveFile& operator=(const SaveFile&) = delete;
+
+	// Creates the file if it doesn't exist and grows it to size bytes if it is smaller
+	// @return false if the file couldn't be opened or mapped
+	bool open(const std::string& fileName, size_t size);
+	void close();
+
+	byte* data() const { return mem; }
+	size_t size() const { return memSize; }
+	bool writesBack() const { return copy.empty(); } // false for a private copy of a file someone else has open
+
+	// Starts writing [offset, offset + length) back to the file without waiting for it
+	void flush(size_t offset, size_t length);
+
+private:
+	byte* mem = nullptr;
+	size_t memSize = 0;
+	std::vector<byte> copy; // the save when the file is locked by another cart
+
+#ifdef _WIN32
+	void* file = nullptr;
+	void* mapping = nullptr;
+#else
+	int fd = -1; // kept open for the lock
+#endif
+};
+
+#endif // GB_SAVEFILE_H
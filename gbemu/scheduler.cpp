@@ -0,0 +1,100 @@
+#include "scheduler.h"
+
+void Scheduler::schedule(int event, uint64_t when)
+{
+	if (scheduled(event))
+	{
+		const int i = pos[event];
+		const uint64_t old = heap[i].when;
+		heap[i].when = when;
+		if (when < old)
+		{
+			siftUp(i);
+		}
+		else
+		{
+			siftDown(i);
+		}
+		return;
+	}
+	place(size, { when, event });
+	size++;
+	siftUp(size - 1);
+}
+
+void Scheduler::cancel(int event)
+{
+	const int i = pos[event];
+	if (i < 0)
+	{
+		return;
+	}
+	pos[event] = -1;
+	size--;
+	if (i == size)
+	{
+		return;
+	}
+	// the last entry takes its place and moves whichever way it needs to
+	const Entry last = heap[size];
+	place(i, last);
+	siftUp(i);
+	siftDown(pos[last.event]);
+}
+
+void Scheduler::clear()
+{
+	for (int& p : pos)
+	{
+		p = -1;
+	}
+	size = 0;
+}
+
+int Scheduler::pop()
+{
+	const int event = heap[0].event;
+	cancel(event);
+	return event;
+}
+
+void Scheduler::place(int i, const Entry& entry)
+{
+	heap[i] = entry;
+	pos[entry.event] = i;
+}
+
+void Scheduler::siftUp(int i)
+{
+	const Entry entry = heap[i];
+	while (i > 0 && entry.when < heap[(i - 1) / 2].when)
+	{
+		place(i, heap[(i - 1) / 2]);
+		i = (i - 1) / 2;
+	}
+	place(i, entry);
+}
+
+void Scheduler::siftDown(int i)
+{
+	const Entry entry = heap[i];
+	for (;;)
+	{
+		int child = i * 2 + 1;
+		if (child >= size)
+		{
+			break;
+		}
+		if (child + 1 < size && heap[child + 1].when < heap[child].when)
+		{
+			child++;
+		}
+		if (heap[child].when >= entry.when)
+		{
+			break;
+		}
+		place(i, heap[child]);
+		i = child;
+	}
+	place(i, entry);
+}
@@ -0,0 +1,52 @@
+#ifndef GB_SCHEDULER_H
+#define GB_SCHEDULER_H
+
+#include <cstdint>
+
+// The things that happen at set times, each one is either scheduled once or not at all
+enum Events
+{
+	evLCD = 0,	// the PPU's next mode change, LY moves on at the start of each line
+	evSerial,	// a serial transfer finished
+	evTimer,	// TIMA overflows
+	evLYC,		// LY reaches LYC with the STAT interrupt for it enabled
+	numEvents
+};
+
+// Keeps when each of the Events is next due in master clock cycles, as a min heap
+// The CPU runs straight through until the earliest of them instead of checking every subsystem after every instruction
+class Scheduler
+{
+public:
+	Scheduler() { clear(); }
+
+	// @param when replaces the time the event was already scheduled for
+	void schedule(int event, uint64_t when);
+	void cancel(int event);
+	void clear();
+
+	bool scheduled(int event) const { return pos[event] >= 0; }
+	uint64_t when(int event) const { return heap[pos[event]].when; }
+
+	// @return the time the earliest event is due, UINT64_MAX if there aren't any
+	inline uint64_t next() const { return size > 0 ? heap[0].when : UINT64_MAX; }
+	// Removes the earliest event
+	// @return which one it was
+	int pop();
+
+private:
+	struct Entry
+	{
+		uint64_t when;
+		int event;
+	};
+	Entry heap[numEvents];
+	int pos[numEvents]; // of each event in the heap, -1 if it isn't scheduled
+	int size;
+
+	void place(int i, const Entry& entry);
+	void siftUp(int i);
+	void siftDown(int i);
+};
+
+#endif // GB_SCHEDULER_H
@@ -2,6 +2,14 @@
 #define GB_COMMON_H
 
 #include <cstdint>
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
+// Host byte order, MSVC only targets little endian hosts
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+#define GB_BIG_ENDIAN
+#endif
 
 typedef uint16_t addr16; // 16-bit address
 typedef uint8_t addr8; // 8-bit address
@@ -17,4 +25,20 @@ typedef int16_t word;
 typedef uint16_t uword;
 typedef int16_t sword;
 
+// @return the index of the lowest set bit of a non zero mask
+inline int lowestBit(uint64_t mask)
+{
+#ifdef _MSC_VER
+	unsigned long index;
+	if (_BitScanForward(&index, static_cast<unsigned long>(mask)) == 0) // there is no 64 bit version on 32 bit hosts
+	{
+		_BitScanForward(&index, static_cast<unsigned long>(mask >> 32));
+		index += 32;
+	}
+	return static_cast<int>(index);
+#else
+	return __builtin_ctzll(mask);
+#endif
+}
+
 #endif // GB_COMMON_H
\ No newline at end of file